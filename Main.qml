@@ -35,6 +35,17 @@ Window {
         }
     }
 
+    FileDialog{
+        id:exportDialog
+        fileMode: FileDialog.SaveFile
+        nameFilters: ["MP4 (*.mp4)", "MKV (*.mkv)"]
+        onAccepted: {
+            if (videoPlayer.exportFile(exportDialog.selectedFile, playbackSpeedSlider.value)) {
+                exportLabel.text="导出:0%"
+            }
+        }
+    }
+
     Row {
         anchors.fill: parent
         spacing: 10
@@ -56,6 +67,12 @@ Window {
                     slider.to=videoPlayer.duration
 
                 }
+                onExportProgress: function(progress, realtimeFactor) {
+                    exportLabel.text="导出:"+Math.round(progress*100)+"% "+realtimeFactor.toFixed(1)+"x"
+                }
+                onExportFinished: function(ok, outputFile) {
+                    exportLabel.text=ok?"导出完成":"导出失败"
+                }
                 onPositionChanged: {
 
                     if(!slider.pressed){
@@ -65,6 +82,15 @@ Window {
                     }
                 }
 
+                WaveformView{
+                    id:waveformView
+                    width:videoPlayer.width
+                    height:40
+                    anchors.bottom:parent.bottom
+                    source:videoPlayer.source
+                    opacity:slider.opacity
+                }
+
                 Slider{
                     id:slider
                     width:videoPlayer.width
@@ -80,7 +106,12 @@ Window {
 
                            var intValue=Math.floor(slider.value)
 
-                           videoPlayer.setPosi(intValue)
+                           videoPlayer.seekPreview(intValue)
+                        }
+                    }
+                    onPressedChanged: {
+                        if(!slider.pressed){
+                            videoPlayer.seekCommit(Math.floor(slider.value))
                         }
                     }
                     Keys.onPressed: {
@@ -157,6 +188,20 @@ Window {
                 color:"white"
                 text: "速度:1.0"
             }
+            Button{
+                text:"导出"
+                onClicked: exportDialog.open()
+            }
+            Label{
+                color:"white"
+                text:"缓冲中 "+videoPlayer.bufferingPercent+"%"
+                visible:videoPlayer.buffering
+            }
+            Label{
+                id:exportLabel
+                color:"white"
+                text:""
+            }
             Button{
                 text:"全屏"
                 onClicked: {
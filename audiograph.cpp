@@ -0,0 +1,78 @@
+#include "audiograph.h"
+
+extern "C" {
+#include <libavutil/opt.h>
+#include <libavutil/channel_layout.h>
+}
+
+int createAudioFilterGraph(const AVCodecContext *decCtx, AVRational timeBase, const char *descr,
+                           AVSampleFormat outFormat, AVFilterGraph **graph,
+                           AVFilterContext **src, AVFilterContext **sink)
+{
+    char args[512];
+    int ret = 0;
+    const AVFilter *buffersrc  = avfilter_get_by_name("abuffer");
+    const AVFilter *buffersink = avfilter_get_by_name("abuffersink");
+    const enum AVSampleFormat sample_fmts[] = { outFormat, AV_SAMPLE_FMT_NONE };
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterInOut *inputs  = avfilter_inout_alloc();
+    uint64_t channelLayout = decCtx->channel_layout ? decCtx->channel_layout
+                                                    : av_get_default_channel_layout(decCtx->channels);
+
+    *graph = avfilter_graph_alloc();
+    if (!outputs || !inputs || !*graph) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    snprintf(args, sizeof(args),
+             "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%" PRIx64,
+             timeBase.num, timeBase.den, decCtx->sample_rate,
+             av_get_sample_fmt_name(decCtx->sample_fmt), channelLayout);
+    ret = avfilter_graph_create_filter(src, buffersrc, "in", args, nullptr, *graph);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot create buffer source\n");
+        goto end;
+    }
+
+    ret = avfilter_graph_create_filter(sink, buffersink, "out", nullptr, nullptr, *graph);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot create buffer sink\n");
+        goto end;
+    }
+
+    //volume只处理浮点，固定输出格式后整数格式的源会由自动插入的转换变回原格式
+    if (outFormat != AV_SAMPLE_FMT_NONE) {
+        ret = av_opt_set_int_list(*sink, "sample_fmts", sample_fmts, -1, AV_OPT_SEARCH_CHILDREN);
+        if (ret < 0) {
+            av_log(nullptr, AV_LOG_ERROR, "Cannot set output sample format\n");
+            goto end;
+        }
+    }
+
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = *src;
+    outputs->pad_idx    = 0;
+    outputs->next       = nullptr;
+
+    inputs->name       = av_strdup("out");
+    inputs->filter_ctx = *sink;
+    inputs->pad_idx    = 0;
+    inputs->next       = nullptr;
+
+    if ((ret = avfilter_graph_parse_ptr(*graph, descr, &inputs, &outputs, nullptr)) < 0)
+        goto end;
+    if ((ret = avfilter_graph_config(*graph, nullptr)) < 0)
+        goto end;
+
+end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    if (ret < 0 && *graph) {
+        avfilter_graph_free(graph);
+        *graph = nullptr;
+    }
+
+    return ret;
+}
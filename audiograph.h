@@ -0,0 +1,20 @@
+#ifndef AUDIOGRAPH_H
+#define AUDIOGRAPH_H
+
+#include <QDebug>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+}
+
+//建立音频滤镜图 abuffer -> descr -> abuffersink，播放、A-B循环缓冲和导出共用。
+//abuffer的参数取自解码器，timeBase为送入帧的pts时间基；outFormat不为AV_SAMPLE_FMT_NONE时固定输出采样格式。
+//失败时释放已分配的图，*graph置为nullptr，返回FFmpeg错误码
+int createAudioFilterGraph(const AVCodecContext *decCtx, AVRational timeBase, const char *descr,
+                           AVSampleFormat outFormat, AVFilterGraph **graph,
+                           AVFilterContext **src, AVFilterContext **sink);
+
+#endif // AUDIOGRAPH_H
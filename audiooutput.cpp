@@ -0,0 +1,231 @@
+#include "audiooutput.h"
+#include <QDataStream>
+
+//根据spec创建输出后端，无法识别时使用Qt默认设备
+AudioOutput *AudioOutput::create(const QString &spec)
+{
+    if (spec == QLatin1String("null"))
+        return new NullAudioOutput(NullAudioOutput::Realtime);
+    if (spec == QLatin1String("null:fast"))
+        return new NullAudioOutput(NullAudioOutput::Unthrottled);
+    if (spec.startsWith(QLatin1String("wav:")))
+        return new WavFileAudioOutput(spec.mid(4), NullAudioOutput::Realtime);
+    if (spec.startsWith(QLatin1String("wav-fast:")))
+        return new WavFileAudioOutput(spec.mid(9), NullAudioOutput::Unthrottled);
+    if (!spec.isEmpty() && spec != QLatin1String("qt"))
+        qWarning() << "未知的音频输出" << spec << "，使用默认设备";
+    return new QtAudioOutput();
+}
+
+QtAudioOutput::~QtAudioOutput()
+{
+    stop();
+}
+
+bool QtAudioOutput::start(const QAudioFormat &format)
+{
+    stop();
+    audioSink = new QAudioSink(QMediaDevices::defaultAudioOutput(), format);
+    audioIODevice = audioSink->start();
+    return audioIODevice != nullptr;
+}
+
+void QtAudioOutput::stop()
+{
+    if (audioSink) {
+        audioSink->stop();
+        delete audioSink;
+        audioSink = nullptr;
+    }
+    audioIODevice = nullptr;
+}
+
+void QtAudioOutput::suspend()
+{
+    if (audioSink)
+        audioSink->suspend();
+}
+
+void QtAudioOutput::resume()
+{
+    if (audioSink)
+        audioSink->resume();
+}
+
+qint64 QtAudioOutput::bytesFree()
+{
+    return audioSink ? audioSink->bytesFree() : 0;
+}
+
+qint64 QtAudioOutput::bufferSize()
+{
+    return audioSink ? audioSink->bufferSize() : 0;
+}
+
+qint64 QtAudioOutput::write(const QByteArray &data)
+{
+    return audioIODevice ? audioIODevice->write(data) : -1;
+}
+
+qint64 QtAudioOutput::processedUSecs()
+{
+    return audioSink ? audioSink->processedUSecs() : 0;
+}
+
+NullAudioOutput::NullAudioOutput(ClockMode mode)
+    : clockMode(mode){
+
+}
+
+bool NullAudioOutput::start(const QAudioFormat &f)
+{
+    format = f;
+    capacity = format.bytesForDuration(bufferUSecs);
+    queued = 0;
+    consumed = 0;
+    clockUSecs = 0;
+    suspended = false;
+    clock.start();
+    return capacity > 0;
+}
+
+void NullAudioOutput::stop()
+{
+    queued = 0;
+    capacity = 0;
+}
+
+void NullAudioOutput::suspend()
+{
+    drain();
+    suspended = true;
+}
+
+void NullAudioOutput::resume()
+{
+    if (!suspended)
+        return;
+    suspended = false;
+    //暂停期间时钟不前进
+    clockUSecs = clock.nsecsElapsed() / 1000;
+}
+
+//按模拟时钟把已经“播放”的数据从缓冲中移除，按整帧推进避免舍入误差累积
+void NullAudioOutput::drain()
+{
+    if (suspended || capacity <= 0)
+        return;
+
+    if (clockMode == Unthrottled) {
+        consumed += queued;
+        queued = 0;
+        return;
+    }
+
+    qint64 nowUSecs = clock.nsecsElapsed() / 1000;
+    qint64 bytes = format.bytesForDuration(nowUSecs - clockUSecs);
+    if (bytes <= 0)
+        return;
+    clockUSecs += format.durationForBytes(bytes);
+
+    //缓冲耗尽时相当于声卡欠载，多出来的时间直接丢弃
+    bytes = qMin(bytes, queued);
+    queued -= bytes;
+    consumed += bytes;
+}
+
+qint64 NullAudioOutput::bytesFree()
+{
+    drain();
+    return capacity - queued;
+}
+
+qint64 NullAudioOutput::bufferSize()
+{
+    return capacity;
+}
+
+qint64 NullAudioOutput::write(const QByteArray &data)
+{
+    if (capacity <= 0)
+        return -1;
+    drain();
+    qint64 n = qMin<qint64>(data.size(), capacity - queued);
+    n -= n % qMax(1, format.bytesPerFrame());
+    queued += n;
+    if (clockMode == Unthrottled)
+        drain();
+    return n;
+}
+
+qint64 NullAudioOutput::processedUSecs()
+{
+    drain();
+    return format.durationForBytes(consumed);
+}
+
+WavFileAudioOutput::WavFileAudioOutput(const QString &fileName, ClockMode mode)
+    : NullAudioOutput(mode){
+    file.setFileName(fileName);
+}
+
+WavFileAudioOutput::~WavFileAudioOutput()
+{
+    stop();
+}
+
+bool WavFileAudioOutput::start(const QAudioFormat &f)
+{
+    stop();
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "无法创建WAV文件" << file.fileName();
+        return false;
+    }
+    dataBytes = 0;
+    if (!NullAudioOutput::start(f))
+        return false;
+    writeHeader(0);
+    return true;
+}
+
+//关闭前回填RIFF和data块的长度
+void WavFileAudioOutput::stop()
+{
+    if (file.isOpen()) {
+        file.seek(0);
+        writeHeader(dataBytes);
+        file.close();
+    }
+    NullAudioOutput::stop();
+}
+
+qint64 WavFileAudioOutput::write(const QByteArray &data)
+{
+    qint64 n = NullAudioOutput::write(data);
+    if (n > 0 && file.isOpen()) {
+        file.write(data.constData(), n);
+        dataBytes += quint32(n);
+    }
+    return n;
+}
+
+//44字节的标准WAV文件头，Float格式写为IEEE float(3)
+void WavFileAudioOutput::writeHeader(quint32 bytes)
+{
+    quint16 channels = quint16(format.channelCount());
+    quint16 bitsPerSample = quint16(format.bytesPerSample() * 8);
+    quint16 formatTag = format.sampleFormat() == QAudioFormat::Float ? 3 : 1;
+    quint32 sampleRate = quint32(format.sampleRate());
+
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.writeRawData("RIFF", 4);
+    out << quint32(36 + bytes);
+    out.writeRawData("WAVE", 4);
+    out.writeRawData("fmt ", 4);
+    out << quint32(16) << formatTag << channels << sampleRate
+        << quint32(sampleRate * format.bytesPerFrame())
+        << quint16(format.bytesPerFrame()) << bitsPerSample;
+    out.writeRawData("data", 4);
+    out << bytes;
+}
@@ -0,0 +1,109 @@
+#ifndef AUDIOOUTPUT_H
+#define AUDIOOUTPUT_H
+
+#include <QAudioFormat>
+#include <QAudioSink>
+#include <QMediaDevices>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QString>
+#include <QFile>
+#include <QDebug>
+
+//音频输出后端接口，AudioThread只通过它写PCM，方便在没有声卡的机器上运行
+class AudioOutput
+{
+public:
+    virtual ~AudioOutput() = default;
+
+    virtual bool start(const QAudioFormat &format) = 0;
+    virtual void stop() = 0;
+    virtual void suspend() {}
+    virtual void resume() {}
+
+    virtual qint64 bytesFree() = 0;
+    virtual qint64 bufferSize() = 0;
+    virtual qint64 write(const QByteArray &data) = 0;
+    //已经播放（消耗）掉的时长，微秒
+    virtual qint64 processedUSecs() = 0;
+
+    //spec格式："qt"(默认)、"null"、"null:fast"、"wav:文件路径"、"wav-fast:文件路径"
+    static AudioOutput *create(const QString &spec);
+};
+
+//Qt默认音频设备
+class QtAudioOutput : public AudioOutput
+{
+public:
+    ~QtAudioOutput() override;
+
+    bool start(const QAudioFormat &format) override;
+    void stop() override;
+    void suspend() override;
+    void resume() override;
+
+    qint64 bytesFree() override;
+    qint64 bufferSize() override;
+    qint64 write(const QByteArray &data) override;
+    qint64 processedUSecs() override;
+
+private:
+    QAudioSink *audioSink=nullptr;
+    QIODevice *audioIODevice=nullptr;
+};
+
+//空输出：按模拟时钟消耗数据，Realtime与真实声卡节奏一致，Unthrottled不做限速
+class NullAudioOutput : public AudioOutput
+{
+public:
+    enum ClockMode{
+        Realtime,
+        Unthrottled
+    };
+
+    explicit NullAudioOutput(ClockMode mode = Realtime);
+
+    bool start(const QAudioFormat &format) override;
+    void stop() override;
+    void suspend() override;
+    void resume() override;
+
+    qint64 bytesFree() override;
+    qint64 bufferSize() override;
+    qint64 write(const QByteArray &data) override;
+    qint64 processedUSecs() override;
+
+    static const qint64 bufferUSecs = 200000;
+
+protected:
+    void drain();
+
+    ClockMode clockMode;
+    QAudioFormat format;
+    QElapsedTimer clock;
+    qint64 clockUSecs=0;      //模拟时钟已经推进到的时刻
+    qint64 capacity=0;
+    qint64 queued=0;
+    qint64 consumed=0;
+    bool suspended=false;
+};
+
+//写入WAV文件，消耗节奏与NullAudioOutput相同
+class WavFileAudioOutput : public NullAudioOutput
+{
+public:
+    WavFileAudioOutput(const QString &fileName, ClockMode mode = Realtime);
+    ~WavFileAudioOutput() override;
+
+    bool start(const QAudioFormat &format) override;
+    void stop() override;
+    qint64 write(const QByteArray &data) override;
+
+private:
+    void writeHeader(quint32 dataBytes);
+
+    QFile file;
+    quint32 dataBytes=0;
+};
+
+#endif // AUDIOOUTPUT_H
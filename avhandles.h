@@ -0,0 +1,42 @@
+#ifndef AVHANDLES_H
+#define AVHANDLES_H
+
+#include <memory>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+//FFmpeg对象的独占句柄：离开作用域时自动释放，在线程之间传递时用std::move表示所有权转移
+struct AVPacketDeleter{
+    void operator()(AVPacket *packet) const{
+        av_packet_free(&packet);
+    }
+};
+
+struct AVFrameDeleter{
+    void operator()(AVFrame *frame) const{
+        av_frame_free(&frame);
+    }
+};
+
+struct AVCodecContextDeleter{
+    void operator()(AVCodecContext *ctx) const{
+        avcodec_free_context(&ctx);
+    }
+};
+
+using PacketPtr = std::unique_ptr<AVPacket, AVPacketDeleter>;
+using FramePtr = std::unique_ptr<AVFrame, AVFrameDeleter>;
+using CodecContextPtr = std::unique_ptr<AVCodecContext, AVCodecContextDeleter>;
+
+inline PacketPtr makePacket(){
+    return PacketPtr(av_packet_alloc());
+}
+
+inline FramePtr makeFrame(){
+    return FramePtr(av_frame_alloc());
+}
+
+#endif // AVHANDLES_H
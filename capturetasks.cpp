@@ -0,0 +1,217 @@
+#include "capturetasks.h"
+#include <QFile>
+#include <QFileInfo>
+
+extern "C" {
+#include <libswscale/swscale.h>
+#include <libavutil/opt.h>
+}
+
+SnapshotTask::SnapshotTask(FramePtr f, const QString &file, int q, Callback callback)
+    : frame(std::move(f)),
+    outputFile(file),
+    quality(qBound(1, q, 100)),
+    done(std::move(callback)){
+    setAutoDelete(true);
+}
+
+AVCodecID SnapshotTask::codecForFile(const QString &file)
+{
+    QString suffix = QFileInfo(file).suffix().toLower();
+    if (suffix == "png")
+        return AV_CODEC_ID_PNG;
+    if (suffix == "jpg" || suffix == "jpeg")
+        return AV_CODEC_ID_MJPEG;
+    if (suffix == "webp")
+        return AV_CODEC_ID_WEBP;
+    return AV_CODEC_ID_NONE;
+}
+
+void SnapshotTask::run()
+{
+    QElapsedTimer clock;
+    clock.start();
+    bool ok = encode();
+    frame.reset();      //尽早归还解码器/滤镜的帧缓冲
+    if (done)
+        done(ok, outputFile, clock.elapsed());
+}
+
+//转换为编码器支持的像素格式后编码一帧，写入文件
+bool SnapshotTask::encode()
+{
+    AVCodecID id = codecForFile(outputFile);
+    if (id == AV_CODEC_ID_NONE || !frame) {
+        qWarning() << "不支持的截图格式" << outputFile;
+        return false;
+    }
+    AVCodec *codec = id == AV_CODEC_ID_WEBP ? avcodec_find_encoder_by_name("libwebp") : avcodec_find_encoder(id);
+    if (!codec)
+        codec = avcodec_find_encoder(id);
+    if (!codec) {
+        qWarning() << "没有可用的图片编码器" << avcodec_get_name(id);
+        return false;
+    }
+
+    AVPixelFormat srcFormat = (AVPixelFormat)frame->format;
+    AVPixelFormat dstFormat = codec->pix_fmts ? avcodec_find_best_pix_fmt_of_list(codec->pix_fmts, srcFormat, 0, nullptr) : srcFormat;
+
+    CodecContextPtr ctx(avcodec_alloc_context3(codec));
+    if (!ctx)
+        return false;
+    ctx->width = frame->width;
+    ctx->height = frame->height;
+    ctx->pix_fmt = dstFormat;
+    ctx->time_base = AVRational{1, 25};
+    if (id == AV_CODEC_ID_MJPEG) {
+        //quality 1~100映射到qscale 31~2
+        ctx->flags |= AV_CODEC_FLAG_QSCALE;
+        ctx->global_quality = FF_QP2LAMBDA * qBound(2, 31 - (quality * 29) / 100, 31);
+        ctx->color_range = AVCOL_RANGE_JPEG;
+    } else if (id == AV_CODEC_ID_WEBP) {
+        av_opt_set_double(ctx.get(), "quality", quality, AV_OPT_SEARCH_CHILDREN);
+    }
+    if (avcodec_open2(ctx.get(), codec, nullptr) < 0) {
+        qWarning() << "无法打开图片编码器" << codec->name;
+        return false;
+    }
+
+    //像素格式不同时转换一份，相同时直接编码引用的帧
+    AVFrame *input = frame.get();
+    FramePtr converted;
+    if (dstFormat != srcFormat) {
+        converted = makeFrame();
+        if (!converted)
+            return false;
+        converted->format = dstFormat;
+        converted->width = frame->width;
+        converted->height = frame->height;
+        if (av_frame_get_buffer(converted.get(), 0) < 0)
+            return false;
+        SwsContext *sws = sws_getContext(frame->width, frame->height, srcFormat,
+                                         frame->width, frame->height, dstFormat,
+                                         SWS_BICUBIC, nullptr, nullptr, nullptr);
+        if (!sws)
+            return false;
+        sws_scale(sws, frame->data, frame->linesize, 0, frame->height, converted->data, converted->linesize);
+        sws_freeContext(sws);
+        input = converted.get();
+    }
+    input->pts = 0;
+
+    if (avcodec_send_frame(ctx.get(), input) < 0 || avcodec_send_frame(ctx.get(), nullptr) < 0) {
+        qWarning() << "截图编码失败";
+        return false;
+    }
+    PacketPtr packet = makePacket();
+    if (!packet || avcodec_receive_packet(ctx.get(), packet.get()) < 0) {
+        qWarning() << "截图编码失败";
+        return false;
+    }
+
+    QFile file(outputFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "无法写入截图" << outputFile;
+        return false;
+    }
+    return file.write((const char *)packet->data, packet->size) == packet->size;
+}
+
+ClipExportTask::ClipExportTask(const QString &file, QVector<AVCodecParameters*> p, QVector<AVRational> tb,
+                               std::vector<PacketPtr> list, Callback callback)
+    : outputFile(file),
+    params(std::move(p)),
+    timeBases(std::move(tb)),
+    packets(std::move(list)),
+    done(std::move(callback)){
+    setAutoDelete(true);
+}
+
+ClipExportTask::~ClipExportTask()
+{
+    for (AVCodecParameters *par : params) {
+        avcodec_parameters_free(&par);
+    }
+}
+
+void ClipExportTask::run()
+{
+    bool ok = remux();
+    packets.clear();
+    if (done)
+        done(ok, outputFile);
+}
+
+//按原编码写入新的封装，时间戳整体平移到从0开始
+bool ClipExportTask::remux()
+{
+    if (packets.empty()) {
+        qWarning() << "没有可导出的数据包";
+        return false;
+    }
+
+    AVFormatContext *outCtx = nullptr;
+    if (avformat_alloc_output_context2(&outCtx, nullptr, nullptr, outputFile.toStdString().c_str()) < 0 || !outCtx) {
+        qWarning() << "无法识别导出片段的封装格式" << outputFile;
+        return false;
+    }
+
+    bool ok = false;
+    QVector<int> mapping(params.size(), -1);
+    int64_t startUs = INT64_MAX;
+
+    for (int i = 0; i < params.size(); ++i) {
+        if (!params.at(i))
+            continue;
+        AVStream *st = avformat_new_stream(outCtx, nullptr);
+        if (!st || avcodec_parameters_copy(st->codecpar, params.at(i)) < 0)
+            goto end;
+        st->codecpar->codec_tag = 0;
+        st->time_base = timeBases.at(i);
+        mapping[i] = st->index;
+    }
+
+    if (!(outCtx->oformat->flags & AVFMT_NOFILE)
+        && avio_open(&outCtx->pb, outputFile.toStdString().c_str(), AVIO_FLAG_WRITE) < 0) {
+        qWarning() << "无法创建导出片段" << outputFile;
+        goto end;
+    }
+    if (avformat_write_header(outCtx, nullptr) < 0) {
+        qWarning() << "导出片段的封装不支持这些编码";
+        goto end;
+    }
+
+    for (const PacketPtr &packet : packets) {
+        int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+        if (ts != AV_NOPTS_VALUE)
+            startUs = qMin(startUs, av_rescale_q(ts, timeBases.at(packet->stream_index), AV_TIME_BASE_Q));
+    }
+    if (startUs == INT64_MAX)
+        startUs = 0;
+
+    for (PacketPtr &packet : packets) {
+        int in = packet->stream_index;
+        int out = in >= 0 && in < mapping.size() ? mapping.at(in) : -1;
+        if (out < 0)
+            continue;
+        int64_t offset = av_rescale_q(startUs, AV_TIME_BASE_Q, timeBases.at(in));
+        if (packet->pts != AV_NOPTS_VALUE)
+            packet->pts -= offset;
+        if (packet->dts != AV_NOPTS_VALUE)
+            packet->dts -= offset;
+        av_packet_rescale_ts(packet.get(), timeBases.at(in), outCtx->streams[out]->time_base);
+        packet->stream_index = out;
+        packet->pos = -1;
+        if (av_interleaved_write_frame(outCtx, packet.get()) < 0) {
+            qWarning() << "写入导出片段失败";
+            goto end;
+        }
+    }
+    ok = av_write_trailer(outCtx) >= 0;
+
+end:
+    if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&outCtx->pb);
+    avformat_free_context(outCtx);
+    return ok;
+}
@@ -0,0 +1,71 @@
+#ifndef CAPTURETASKS_H
+#define CAPTURETASKS_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <functional>
+#include <vector>
+#include "avhandles.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+//最近播放过的一个数据包（引用，不拷贝数据），ms为毫秒时间戳
+struct CapturedPacket{
+    PacketPtr packet;
+    qint64 ms=0;
+};
+
+//截图任务：持有解码帧的引用，在线程池中转换像素格式并用libavcodec编码为PNG/JPEG/WebP
+class SnapshotTask : public QRunnable
+{
+public:
+    using Callback = std::function<void(bool ok, const QString &outputFile, qint64 elapsedMs)>;
+
+    //frame的所有权转移给任务，quality为1~100，只对JPEG和WebP有效
+    SnapshotTask(FramePtr frame, const QString &outputFile, int quality, Callback done);
+
+    void run() override;
+
+    //按扩展名选择编码器：png、jpg/jpeg、webp，不支持时返回AV_CODEC_ID_NONE
+    static AVCodecID codecForFile(const QString &outputFile);
+
+private:
+    bool encode();
+
+    FramePtr frame;
+    QString outputFile;
+    int quality=90;
+    Callback done;
+};
+
+//片段导出任务：把最近的数据包按原编码直接封装（stream copy），不重新编码
+class ClipExportTask : public QRunnable
+{
+public:
+    using Callback = std::function<void(bool ok, const QString &outputFile)>;
+
+    //params和timeBases按输入流序号排列，packets的stream_index指向输入流；所有参数的所有权转移给任务
+    ClipExportTask(const QString &outputFile, QVector<AVCodecParameters*> params, QVector<AVRational> timeBases,
+                   std::vector<PacketPtr> packets, Callback done);
+    ~ClipExportTask();
+
+    void run() override;
+
+private:
+    bool remux();
+
+    QString outputFile;
+    QVector<AVCodecParameters*> params;
+    QVector<AVRational> timeBases;
+    std::vector<PacketPtr> packets;
+    Callback done;
+};
+
+#endif // CAPTURETASKS_H
@@ -0,0 +1,78 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+//单生产者单消费者无锁环形队列：GUI线程写入，管线线程读取，两端都不需要加锁
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+    bool push(const T &item){
+        size_t tail=m_tail.load(std::memory_order_relaxed);
+        size_t next=(tail+1)%Capacity;
+        if(next==m_head.load(std::memory_order_acquire))
+            return false;
+        items[tail]=item;
+        m_tail.store(next,std::memory_order_release);
+        return true;
+    }
+
+    //只在入队成功时移走item，失败时调用者仍持有item
+    bool push(T &&item){
+        size_t tail=m_tail.load(std::memory_order_relaxed);
+        size_t next=(tail+1)%Capacity;
+        if(next==m_head.load(std::memory_order_acquire))
+            return false;
+        items[tail]=std::move(item);
+        m_tail.store(next,std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item){
+        size_t head=m_head.load(std::memory_order_relaxed);
+        if(head==m_tail.load(std::memory_order_acquire))
+            return false;
+        item=std::move(items[head]);
+        m_head.store((head+1)%Capacity,std::memory_order_release);
+        return true;
+    }
+
+    //近似值，只用于统计
+    size_t size() const{
+        size_t head=m_head.load(std::memory_order_acquire);
+        size_t tail=m_tail.load(std::memory_order_acquire);
+        return (tail+Capacity-head)%Capacity;
+    }
+
+    bool isEmpty() const{
+        return size()==0;
+    }
+
+private:
+    std::array<T,Capacity> items{};
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+//发往管线线程的控制命令，serial为发出命令时的播放代数
+struct PlayerCommand{
+    enum Type{
+        Seek,
+        Pause,
+        Resume,
+        Speed,
+        Flush,
+        Hold        //预缓冲：继续解码，暂不输出
+    };
+    Type type=Flush;
+    int serial=0;
+    qint64 position=0;
+    double speed=1.0;
+};
+
+#endif // COMMANDQUEUE_H
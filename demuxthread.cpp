@@ -0,0 +1,130 @@
+#include "demuxthread.h"
+
+DemuxThread::DemuxThread(AVFormatContext *ctx, const QString &u, AVDictionary *opts, int t, QObject *parent)
+    : QThread(parent),
+    formatCtx(ctx),
+    url(u),
+    token(t){
+    av_dict_copy(&options, opts, 0);
+}
+
+DemuxThread::~DemuxThread() {
+    abort();
+    wait();
+    av_dict_free(&options);
+}
+
+AVFormatContext *DemuxThread::takeContext()
+{
+    QMutexLocker locker(&mutex);
+    if (aborted || !openOk || !formatCtx)
+        return nullptr;
+    taken = true;
+    return formatCtx;
+}
+
+void DemuxThread::startReading(int serial)
+{
+    QMutexLocker locker(&mutex);
+    hasRequest = true;
+    requestSerial = serial;
+    requestTimestamp = AV_NOPTS_VALUE;
+    request.wakeAll();
+}
+
+//只记录最新的请求，由本线程在两次读取之间执行；旧代数的包由takePacket()丢弃
+void DemuxThread::seek(int serial, int64_t timestamp)
+{
+    QMutexLocker locker(&mutex);
+    hasRequest = true;
+    requestSerial = serial;
+    requestTimestamp = timestamp;
+    request.wakeAll();
+}
+
+int DemuxThread::takePacket(PacketPtr &packet, int serial)
+{
+    DemuxedPacket item;
+    while (queue.pop(item)) {
+        if (item.serial != serial)
+            continue;
+        if (!item.packet)
+            return AVERROR_EOF;
+        packet = std::move(item.packet);
+        return 0;
+    }
+    return AVERROR(EAGAIN);
+}
+
+//调用前应先中断网络缓存，使阻塞中的读取立即返回
+void DemuxThread::abort()
+{
+    QMutexLocker locker(&mutex);
+    aborted = true;
+    request.wakeAll();
+}
+
+void DemuxThread::run()
+{
+    int ret = avformat_open_input(&formatCtx, url.toStdString().c_str(), nullptr, &options);
+    if (ret == 0 && avformat_find_stream_info(formatCtx, nullptr) < 0) {
+        qWarning() << "无法获取流信息";
+        ret = AVERROR_INVALIDDATA;
+    }
+    if (ret != 0) {
+        qWarning() << "无法打开网络输入" << url;
+    }
+    {
+        QMutexLocker locker(&mutex);
+        openOk = ret == 0;
+    }
+    emit opened(token, ret == 0);
+
+    int serial = -1;
+    bool eof = false;
+    while (ret == 0) {
+        int64_t timestamp = AV_NOPTS_VALUE;
+        {
+            QMutexLocker locker(&mutex);
+            //队列满、读完或还没开始读时等待，界面线程取走包后按超时重新检查
+            while (!aborted && !hasRequest && (serial < 0 || eof || queue.size() >= queueCapacity - 1))
+                request.wait(&mutex, 10);
+            if (aborted)
+                break;
+            if (hasRequest) {
+                hasRequest = false;
+                serial = requestSerial;
+                timestamp = requestTimestamp;
+                eof = false;
+            }
+        }
+
+        if (timestamp != AV_NOPTS_VALUE) {
+            if (avformat_seek_file(formatCtx, -1, INT64_MIN, timestamp, INT64_MAX, AVSEEK_FLAG_BACKWARD) < 0)
+                qWarning() << "无法跳转到指定位置";
+            continue;
+        }
+
+        PacketPtr packet = makePacket();
+        if (!packet)
+            break;
+        int readRet = av_read_frame(formatCtx, packet.get());
+        {
+            QMutexLocker locker(&mutex);
+            if (aborted)
+                break;
+        }
+        if (readRet < 0) {
+            if (readRet != AVERROR_EOF)
+                qWarning() << "网络输入读取失败，按文件结束处理";
+            //空包作为该代数的结束标记
+            packet.reset();
+            eof = true;
+        }
+        queue.push(DemuxedPacket{std::move(packet), serial});
+    }
+
+    QMutexLocker locker(&mutex);
+    if (!taken && formatCtx)
+        avformat_close_input(&formatCtx);
+}
@@ -0,0 +1,69 @@
+#ifndef DEMUXTHREAD_H
+#define DEMUXTHREAD_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QString>
+#include <QDebug>
+#include "avhandles.h"
+#include "commandqueue.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+//解复用得到的一个包，packet为空表示该代数已读到文件尾
+struct DemuxedPacket{
+    PacketPtr packet;
+    int serial=0;
+};
+
+//网络输入的打开、探测和解复用线程：网络数据未到时阻塞在这里，不阻塞界面线程。
+//打开完成后发出opened()，界面线程取走上下文并调用startReading()；之后包经无锁队列交给界面线程
+class DemuxThread : public QThread
+{
+    Q_OBJECT
+public:
+    //formatCtx已经装好网络缓存的AVIOContext，所有权转移给本线程，直到takeContext()
+    DemuxThread(AVFormatContext *formatCtx, const QString &url, AVDictionary *options, int token, QObject *parent = nullptr);
+    ~DemuxThread();
+
+    void run() override;
+
+    //打开成功后取走上下文，之后由调用者关闭；线程结束前调用者不能关闭它
+    AVFormatContext *takeContext();
+
+    //以下由界面线程调用
+    void startReading(int serial);
+    void seek(int serial, int64_t timestamp);
+    //取出serial代数的下一个包：成功返回0，还没有数据返回AVERROR(EAGAIN)，读完返回AVERROR_EOF
+    int takePacket(PacketPtr &packet, int serial);
+    void abort();
+
+    static const int queueCapacity = 512;
+
+signals:
+    void opened(int token, bool ok);
+
+private:
+    AVFormatContext *formatCtx=nullptr;
+    QString url;
+    AVDictionary *options=nullptr;
+    int token=0;
+
+    QMutex mutex;
+    QWaitCondition request;
+    bool aborted=false;
+    bool taken=false;
+    bool openOk=false;
+    bool hasRequest=false;
+    int requestSerial=-1;
+    int64_t requestTimestamp=AV_NOPTS_VALUE;     //AV_NOPTS_VALUE表示从当前位置继续读
+
+    SpscQueue<DemuxedPacket, queueCapacity> queue;
+};
+
+#endif // DEMUXTHREAD_H
@@ -0,0 +1,509 @@
+#include "exportthread.h"
+#include "audiograph.h"
+#include <QFile>
+#include <QStringList>
+
+ExportThread::ExportThread(QObject *parent)
+    : QThread(parent){
+
+}
+
+ExportThread::~ExportThread() {
+    cancel();
+    wait();
+}
+
+//设置导出任务，需在start()之前调用
+void ExportThread::setJob(const QString &input, const QString &output, double s)
+{
+    inputFile=input;
+    outputFile=output;
+    speed=s;
+    //在这里清除取消标志，start()之前调用的cancel()不会被run()覆盖
+    cancelFlag=false;
+}
+
+void ExportThread::cancel()
+{
+    cancelFlag=true;
+}
+
+//atempo单级只支持0.5~2.0，超出范围时串联多级
+QString ExportThread::atempoChain(double s)
+{
+    QStringList chain;
+    while (s > 2.0) {
+        chain << QStringLiteral("atempo=2.0");
+        s /= 2.0;
+    }
+    while (s < 0.5) {
+        chain << QStringLiteral("atempo=0.5");
+        s /= 0.5;
+    }
+    chain << QString::asprintf("atempo=%.3f", s);
+    return chain.join(',');
+}
+
+//打开输入文件并选择音视频流
+int ExportThread::openInput()
+{
+    int ret = avformat_open_input(&inCtx, inputFile.toStdString().c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        qWarning() << "导出：无法打开文件";
+        return ret;
+    }
+    if ((ret = avformat_find_stream_info(inCtx, nullptr)) < 0) {
+        qWarning() << "导出：无法获取流信息";
+        return ret;
+    }
+
+    video.inIndex = av_find_best_stream(inCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    audio.inIndex = av_find_best_stream(inCtx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (video.inIndex < 0 && audio.inIndex < 0) {
+        qWarning() << "导出：未找到音视频流";
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+
+    durationSec = inCtx->duration > 0 ? inCtx->duration / (double)AV_TIME_BASE : 0;
+    return 0;
+}
+
+//根据输出文件名推断封装格式和编码器
+int ExportThread::openOutput()
+{
+    int ret = avformat_alloc_output_context2(&outCtx, nullptr, nullptr, outputFile.toStdString().c_str());
+    if (ret < 0 || !outCtx) {
+        qWarning() << "导出：无法识别输出格式";
+        return ret < 0 ? ret : AVERROR_UNKNOWN;
+    }
+
+    if (video.inIndex >= 0) {
+        video.encoder = avcodec_find_encoder(outCtx->oformat->video_codec);
+        if (!video.encoder) {
+            qWarning() << "导出：未找到视频编码器";
+            return AVERROR_ENCODER_NOT_FOUND;
+        }
+    }
+    if (audio.inIndex >= 0) {
+        audio.encoder = avcodec_find_encoder(outCtx->oformat->audio_codec);
+        if (!audio.encoder) {
+            qWarning() << "导出：未找到音频编码器";
+            return AVERROR_ENCODER_NOT_FOUND;
+        }
+    }
+    return 0;
+}
+
+//打开解码器，使用ffmpeg内部线程池
+int ExportThread::openDecoder(ExportStream &es)
+{
+    AVStream *st = inCtx->streams[es.inIndex];
+    AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (!codec) {
+        qWarning() << "导出：未找到解码器";
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+    es.decCtx = avcodec_alloc_context3(codec);
+    if (!es.decCtx)
+        return AVERROR(ENOMEM);
+    int ret = avcodec_parameters_to_context(es.decCtx, st->codecpar);
+    if (ret < 0)
+        return ret;
+    es.decCtx->pkt_timebase = st->time_base;
+    es.decCtx->thread_count = 0;
+    if ((ret = avcodec_open2(es.decCtx, codec, nullptr)) < 0) {
+        qWarning() << "导出：无法打开解码器";
+        return ret;
+    }
+    if (!es.decCtx->channel_layout && es.decCtx->channels)
+        es.decCtx->channel_layout = av_get_default_channel_layout(es.decCtx->channels);
+    return 0;
+}
+
+//视频编码器：保持原分辨率和帧率，多线程编码
+int ExportThread::openVideoEncoder(ExportStream &es)
+{
+    AVStream *st = inCtx->streams[es.inIndex];
+    AVRational frameRate = av_guess_frame_rate(inCtx, st, nullptr);
+    if (frameRate.num <= 0 || frameRate.den <= 0)
+        frameRate = AVRational{25, 1};
+
+    es.encCtx = avcodec_alloc_context3(es.encoder);
+    if (!es.encCtx)
+        return AVERROR(ENOMEM);
+    es.encCtx->width = es.decCtx->width;
+    es.encCtx->height = es.decCtx->height;
+    es.encCtx->sample_aspect_ratio = es.decCtx->sample_aspect_ratio;
+    es.encCtx->pix_fmt = es.encoder->pix_fmts ? es.encoder->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+    es.encCtx->framerate = frameRate;
+    es.encCtx->time_base = av_inv_q(frameRate);
+    es.encCtx->thread_count = 0;
+    if (outCtx->oformat->flags & AVFMT_GLOBALHEADER)
+        es.encCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    int ret = avcodec_open2(es.encCtx, es.encoder, nullptr);
+    if (ret < 0) {
+        qWarning() << "导出：无法打开视频编码器";
+        return ret;
+    }
+
+    es.outStream = avformat_new_stream(outCtx, nullptr);
+    if (!es.outStream)
+        return AVERROR(ENOMEM);
+    es.outStream->time_base = es.encCtx->time_base;
+    return avcodec_parameters_from_context(es.outStream->codecpar, es.encCtx);
+}
+
+//音频编码器：沿用原采样率和声道布局
+int ExportThread::openAudioEncoder(ExportStream &es)
+{
+    es.encCtx = avcodec_alloc_context3(es.encoder);
+    if (!es.encCtx)
+        return AVERROR(ENOMEM);
+    es.encCtx->sample_rate = es.decCtx->sample_rate;
+    es.encCtx->channel_layout = es.decCtx->channel_layout;
+    es.encCtx->channels = av_get_channel_layout_nb_channels(es.decCtx->channel_layout);
+    es.encCtx->sample_fmt = es.encoder->sample_fmts ? es.encoder->sample_fmts[0] : es.decCtx->sample_fmt;
+    es.encCtx->time_base = AVRational{1, es.decCtx->sample_rate};
+    es.encCtx->bit_rate = 128000;
+    es.encCtx->thread_count = 0;
+    if (outCtx->oformat->flags & AVFMT_GLOBALHEADER)
+        es.encCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    int ret = avcodec_open2(es.encCtx, es.encoder, nullptr);
+    if (ret < 0) {
+        qWarning() << "导出：无法打开音频编码器";
+        return ret;
+    }
+
+    es.outStream = avformat_new_stream(outCtx, nullptr);
+    if (!es.outStream)
+        return AVERROR(ENOMEM);
+    es.outStream->time_base = es.encCtx->time_base;
+    return avcodec_parameters_from_context(es.outStream->codecpar, es.encCtx);
+}
+
+//视频滤镜：setpts按速度压缩时间轴，fps按原帧率选帧，format转换为编码器像素格式
+int ExportThread::initVideoFilters(ExportStream &es)
+{
+    char args[512];
+    char filters_descr[256];
+    int ret = 0;
+    AVStream *st = inCtx->streams[es.inIndex];
+    const AVFilter *buffersrc  = avfilter_get_by_name("buffer");
+    const AVFilter *buffersink = avfilter_get_by_name("buffersink");
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterInOut *inputs  = avfilter_inout_alloc();
+
+    es.filterGraph = avfilter_graph_alloc();
+    if (!outputs || !inputs || !es.filterGraph) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    snprintf(args, sizeof(args),
+             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+             es.decCtx->width, es.decCtx->height, es.decCtx->pix_fmt,
+             st->time_base.num, st->time_base.den,
+             es.decCtx->sample_aspect_ratio.num, qMax(es.decCtx->sample_aspect_ratio.den, 1));
+    ret = avfilter_graph_create_filter(&es.buffersrcCtx, buffersrc, "in",
+                                       args, nullptr, es.filterGraph);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot create buffer source\n");
+        goto end;
+    }
+
+    ret = avfilter_graph_create_filter(&es.buffersinkCtx, buffersink, "out",
+                                       nullptr, nullptr, es.filterGraph);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot create buffer sink\n");
+        goto end;
+    }
+
+    snprintf(filters_descr, sizeof(filters_descr), "setpts=PTS/%f,fps=%d/%d,format=%s",
+             speed, es.encCtx->framerate.num, es.encCtx->framerate.den,
+             av_get_pix_fmt_name(es.encCtx->pix_fmt));
+
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = es.buffersrcCtx;
+    outputs->pad_idx    = 0;
+    outputs->next       = nullptr;
+
+    inputs->name       = av_strdup("out");
+    inputs->filter_ctx = es.buffersinkCtx;
+    inputs->pad_idx    = 0;
+    inputs->next       = nullptr;
+
+    if ((ret = avfilter_graph_parse_ptr(es.filterGraph, filters_descr,
+                                        &inputs, &outputs, nullptr)) < 0)
+        goto end;
+    if ((ret = avfilter_graph_config(es.filterGraph, nullptr)) < 0)
+        goto end;
+
+end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    if(ret<0&& es.filterGraph){
+        avfilter_graph_free(&es.filterGraph);
+        es.filterGraph=nullptr;
+    }
+
+    return ret;
+}
+
+//音频滤镜：与播放时相同的atempo，再用aformat转换为编码器格式；解码帧的pts以1/sample_rate为时间基
+int ExportThread::initAudioFilters(ExportStream &es)
+{
+    QByteArray filters_descr = QString::asprintf("%s,aformat=sample_fmts=%s:sample_rates=%d:channel_layouts=0x%" PRIx64,
+                                                 atempoChain(speed).toUtf8().constData(),
+                                                 av_get_sample_fmt_name(es.encCtx->sample_fmt),
+                                                 es.encCtx->sample_rate, es.encCtx->channel_layout).toUtf8();
+    int ret = createAudioFilterGraph(es.decCtx, AVRational{1, es.decCtx->sample_rate}, filters_descr.constData(),
+                                     AV_SAMPLE_FMT_NONE, &es.filterGraph, &es.buffersrcCtx, &es.buffersinkCtx);
+    if (ret < 0)
+        return ret;
+
+    //编码器要求固定帧长时，由buffersink按frame_size切分
+    if (es.encCtx->frame_size > 0 &&
+        !(es.encoder->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+        av_buffersink_set_frame_size(es.buffersinkCtx, es.encCtx->frame_size);
+
+    return 0;
+}
+
+//编码并写入输出文件，frame为nullptr时冲刷编码器
+int ExportThread::encodeWrite(ExportStream &es, AVFrame *frame)
+{
+    int ret = avcodec_send_frame(es.encCtx, frame);
+    if (ret < 0) {
+        qWarning() << "导出：无法发送帧到编码器";
+        return ret;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet)
+        return AVERROR(ENOMEM);
+
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(es.encCtx, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            ret = 0;
+            break;
+        } else if (ret < 0) {
+            qWarning() << "导出：无法接收编码后的数据包";
+            break;
+        }
+        av_packet_rescale_ts(packet, es.encCtx->time_base, es.outStream->time_base);
+        packet->stream_index = es.outStream->index;
+        ret = av_interleaved_write_frame(outCtx, packet);
+        if (ret < 0) {
+            qWarning() << "导出：写入数据包失败";
+            break;
+        }
+    }
+
+    av_packet_free(&packet);
+    return ret;
+}
+
+//送入滤镜并编码所有输出帧，frame为nullptr时冲刷滤镜
+int ExportThread::filterAndEncode(ExportStream &es, AVFrame *frame)
+{
+    int ret = av_buffersrc_add_frame_flags(es.buffersrcCtx, frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+    if (ret < 0) {
+        qWarning() << "导出：无法将帧送入滤镜链";
+        return ret;
+    }
+
+    AVFrame *filt_frame = av_frame_alloc();
+    if (!filt_frame)
+        return AVERROR(ENOMEM);
+
+    AVRational sinkTimeBase = av_buffersink_get_time_base(es.buffersinkCtx);
+    while (true) {
+        ret = av_buffersink_get_frame(es.buffersinkCtx, filt_frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            ret = 0;
+            break;
+        } else if (ret < 0) {
+            qWarning() << "导出：无法从滤镜链获取帧";
+            break;
+        }
+
+        if (es.encCtx->codec_type == AVMEDIA_TYPE_AUDIO) {
+            //音频按采样数连续递增，避免变速后时间戳出现空洞
+            filt_frame->pts = es.nextPts;
+            es.nextPts += filt_frame->nb_samples;
+        } else {
+            filt_frame->pts = av_rescale_q(filt_frame->pts, sinkTimeBase, es.encCtx->time_base);
+            filt_frame->pict_type = AV_PICTURE_TYPE_NONE;
+        }
+
+        ret = encodeWrite(es, filt_frame);
+        av_frame_unref(filt_frame);
+        if (ret < 0)
+            break;
+    }
+
+    av_frame_free(&filt_frame);
+    return ret;
+}
+
+//解码一个数据包，packet为nullptr时冲刷解码器
+int ExportThread::decodePacket(ExportStream &es, AVPacket *packet)
+{
+    int ret = avcodec_send_packet(es.decCtx, packet);
+    if (ret < 0) {
+        qWarning() << "导出：无法发送数据包到解码器";
+        return packet ? 0 : ret;   //损坏的数据包跳过，不中断导出
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        return AVERROR(ENOMEM);
+
+    AVRational streamTimeBase = inCtx->streams[es.inIndex]->time_base;
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(es.decCtx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            ret = 0;
+            break;
+        } else if (ret < 0) {
+            qWarning() << "导出：无法接收解码后的帧";
+            break;
+        }
+
+        int64_t pts = frame->best_effort_timestamp;
+        if (pts != AV_NOPTS_VALUE)
+            reportProgress(pts, streamTimeBase);
+
+        if (es.decCtx->codec_type == AVMEDIA_TYPE_AUDIO && pts != AV_NOPTS_VALUE)
+            frame->pts = av_rescale_q(pts, streamTimeBase, AVRational{1, es.decCtx->sample_rate});
+        else
+            frame->pts = pts;
+
+        ret = filterAndEncode(es, frame);
+        av_frame_unref(frame);
+    }
+
+    av_frame_free(&frame);
+    return ret;
+}
+
+//每200ms上报一次进度和处理速度（相对实时的倍数）
+void ExportThread::reportProgress(int64_t pts, AVRational timeBase)
+{
+    qint64 elapsed = wallClock.elapsed();
+    if (elapsed - lastReport < 200)
+        return;
+    lastReport = elapsed;
+
+    double startSec = inCtx->start_time != AV_NOPTS_VALUE ? inCtx->start_time / (double)AV_TIME_BASE : 0;
+    double mediaSec = pts * av_q2d(timeBase) - startSec;
+    double progress = durationSec > 0 ? qBound(0.0, mediaSec / durationSec, 1.0) : 0;
+    double realtimeFactor = elapsed > 0 ? mediaSec * 1000.0 / elapsed : 0;
+    emit progressChanged(progress, realtimeFactor);
+}
+
+//导出主流程
+void ExportThread::run()
+{
+    lastReport=0;
+    wallClock.start();
+
+    bool ok = false;
+    int ret = 0;
+    AVPacket *packet = nullptr;
+
+    if ((ret = openInput()) < 0 || (ret = openOutput()) < 0)
+        goto end;
+
+    if (video.inIndex >= 0) {
+        if ((ret = openDecoder(video)) < 0 || (ret = openVideoEncoder(video)) < 0 ||
+            (ret = initVideoFilters(video)) < 0)
+            goto end;
+    }
+    if (audio.inIndex >= 0) {
+        if ((ret = openDecoder(audio)) < 0 || (ret = openAudioEncoder(audio)) < 0 ||
+            (ret = initAudioFilters(audio)) < 0)
+            goto end;
+    }
+
+    if (!(outCtx->oformat->flags & AVFMT_NOFILE)) {
+        if ((ret = avio_open(&outCtx->pb, outputFile.toStdString().c_str(), AVIO_FLAG_WRITE)) < 0) {
+            qWarning() << "导出：无法创建输出文件";
+            goto end;
+        }
+    }
+    if ((ret = avformat_write_header(outCtx, nullptr)) < 0) {
+        qWarning() << "导出：无法写入文件头";
+        goto end;
+    }
+
+    packet = av_packet_alloc();
+    if (!packet) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while (!cancelFlag && av_read_frame(inCtx, packet) >= 0) {
+        if (packet->stream_index == video.inIndex)
+            ret = decodePacket(video, packet);
+        else if (packet->stream_index == audio.inIndex)
+            ret = decodePacket(audio, packet);
+        av_packet_unref(packet);
+        if (ret < 0)
+            goto end;
+    }
+    if (cancelFlag)
+        goto end;
+
+    //依次冲刷解码器、滤镜和编码器
+    for (ExportStream *es : {&video, &audio}) {
+        if (es->inIndex < 0)
+            continue;
+        if ((ret = decodePacket(*es, nullptr)) < 0 ||
+            (ret = filterAndEncode(*es, nullptr)) < 0 ||
+            (ret = encodeWrite(*es, nullptr)) < 0)
+            goto end;
+    }
+
+    if ((ret = av_write_trailer(outCtx)) < 0) {
+        qWarning() << "导出：无法写入文件尾";
+        goto end;
+    }
+    ok = true;
+    emit progressChanged(1.0, wallClock.elapsed() > 0 ? durationSec * 1000.0 / wallClock.elapsed() : 0);
+
+end:
+    av_packet_free(&packet);
+    cleanup();
+    if (!ok)
+        QFile::remove(outputFile);
+    emit exportFinished(ok, outputFile);
+}
+
+//释放所有导出资源
+void ExportThread::cleanup()
+{
+    for (ExportStream *es : {&video, &audio}) {
+        if (es->filterGraph)
+            avfilter_graph_free(&es->filterGraph);
+        if (es->decCtx)
+            avcodec_free_context(&es->decCtx);
+        if (es->encCtx)
+            avcodec_free_context(&es->encCtx);
+        *es = ExportStream();
+    }
+    if (inCtx) {
+        avformat_close_input(&inCtx);
+        inCtx = nullptr;
+    }
+    if (outCtx) {
+        if (!(outCtx->oformat->flags & AVFMT_NOFILE) && outCtx->pb)
+            avio_closep(&outCtx->pb);
+        avformat_free_context(outCtx);
+        outCtx = nullptr;
+    }
+}
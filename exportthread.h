@@ -0,0 +1,83 @@
+#ifndef EXPORTTHREAD_H
+#define EXPORTTHREAD_H
+
+#include <QObject>
+#include <QThread>
+#include <QString>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+}
+
+//导出时每路流的解码、滤镜、编码上下文
+struct ExportStream{
+    int inIndex=-1;
+    AVCodec *encoder=nullptr;
+    AVCodecContext *decCtx=nullptr;
+    AVCodecContext *encCtx=nullptr;
+    AVStream *outStream=nullptr;
+    AVFilterGraph *filterGraph=nullptr;
+    AVFilterContext *buffersrcCtx=nullptr;
+    AVFilterContext *buffersinkCtx=nullptr;
+    int64_t nextPts=0;
+};
+
+//离线变速导出：解复用 -> 解码 -> 滤镜(atempo/setpts) -> 编码 -> 封装，不经过QAudioSink和定时器，尽可能快地运行
+class ExportThread : public QThread
+{
+    Q_OBJECT
+public:
+    ExportThread(QObject *parent = nullptr);
+    ~ExportThread();
+
+    void setJob(const QString &inputFile, const QString &outputFile, double speed);
+    void cancel();
+
+    void run() override;
+
+    static QString atempoChain(double speed);
+
+signals:
+    //progress为0~1，realtimeFactor为处理速度相对实时的倍数
+    void progressChanged(double progress, double realtimeFactor);
+    void exportFinished(bool ok, const QString &outputFile);
+
+private:
+    int openInput();
+    int openOutput();
+    int openDecoder(ExportStream &es);
+    int openVideoEncoder(ExportStream &es);
+    int openAudioEncoder(ExportStream &es);
+    int initVideoFilters(ExportStream &es);
+    int initAudioFilters(ExportStream &es);
+    int filterAndEncode(ExportStream &es, AVFrame *frame);
+    int encodeWrite(ExportStream &es, AVFrame *frame);
+    int decodePacket(ExportStream &es, AVPacket *packet);
+    void reportProgress(int64_t pts, AVRational timeBase);
+    void cleanup();
+
+    QString inputFile;
+    QString outputFile;
+    double speed=1.0;
+    std::atomic<bool> cancelFlag{false};
+
+    AVFormatContext *inCtx=nullptr;
+    AVFormatContext *outCtx=nullptr;
+    ExportStream video;
+    ExportStream audio;
+
+    QElapsedTimer wallClock;
+    qint64 lastReport=0;
+    double durationSec=0;
+};
+
+#endif // EXPORTTHREAD_H
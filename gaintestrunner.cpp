@@ -0,0 +1,164 @@
+#include "gaintestrunner.h"
+#include "soakrunner.h"
+#include "videoplayer.h"
+#include <QFile>
+#include <QtEndian>
+#include <cmath>
+#include <cstdio>
+
+GainTestRunner::GainTestRunner(QObject *parent)
+    : QObject(parent),
+    timer(new QTimer(this)){
+    connect(timer, &QTimer::timeout, this, &GainTestRunner::tick);
+}
+
+GainTestRunner::~GainTestRunner() {
+    delete player;
+}
+
+void GainTestRunner::start()
+{
+    clipPath = tempDir.filePath("gain.mkv");
+    wavPath = tempDir.filePath("gain.wav");
+    if (!tempDir.isValid() || !SoakRunner::writeSyntheticClip(clipPath, clipSeconds)) {
+        printf("gain: 无法生成测试片段\n");
+        emit finished(2);
+        return;
+    }
+
+    //第一次打开只为了做响度分析，结果写入缓存
+    player = new VideoPlayer();
+    player->setAudioSink("null");
+    player->setLoudnessNormalization(true);
+    if (!player->loadFile(clipPath)) {
+        printf("gain: 打开失败\n");
+        emit finished(2);
+        return;
+    }
+    enterPhase(Analyzing);
+    timer->start(50);
+}
+
+void GainTestRunner::enterPhase(Phase next)
+{
+    phase = next;
+    phaseClock.start();
+}
+
+void GainTestRunner::check(bool ok, const QString &what)
+{
+    if (ok) {
+        ++passed;
+    } else {
+        failures << what;
+    }
+    printf("gain: %s %s\n", ok ? "通过" : "失败", qPrintable(what));
+    fflush(stdout);
+}
+
+void GainTestRunner::tick()
+{
+    if (phase == Done)
+        return;
+    if (phaseClock.elapsed() > phaseTimeoutMs) {
+        check(false, phase == Analyzing ? "响度分析超时" : "播放超时");
+        finish();
+        return;
+    }
+
+    switch (phase) {
+    case Analyzing: {
+        QVariantMap loudness = player->loudness();
+        if (!loudness.contains("integrated"))
+            break;
+        gainDb = loudness.value("gainDb").toDouble();
+        check(qAbs(gainDb) >= 1.0, QString("归一化增益不为0（%1 dB）").arg(gainDb, 0, 'f', 2));
+        //重新打开时命中响度缓存，第一次建滤镜图就带上volume
+        player->stop();
+        player->setAudioSink("wav:" + wavPath);
+        if (!player->loadFile(clipPath)) {
+            check(false, "重新打开片段");
+            finish();
+            return;
+        }
+        player->play();
+        enterPhase(Playing);
+        break;
+    }
+    case Playing:
+        if (player->state() == VideoPlayer::Ended) {
+            //销毁播放器时关闭音频输出，WAV文件头回填长度
+            delete player;
+            player = nullptr;
+            checkWav();
+            finish();
+        }
+        break;
+    case Done:
+        break;
+    }
+}
+
+//跳过开头和结尾各半秒，只在稳定段上测幅度和过零次数
+void GainTestRunner::checkWav()
+{
+    QFile file(wavPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        check(false, "读取输出的WAV文件");
+        return;
+    }
+    QByteArray wav = file.readAll();
+    if (wav.size() < 44) {
+        check(false, "WAV文件头完整");
+        return;
+    }
+    const uchar *head = reinterpret_cast<const uchar *>(wav.constData());
+    quint16 formatTag = qFromLittleEndian<quint16>(head + 20);
+    quint16 channels = qFromLittleEndian<quint16>(head + 22);
+    quint32 rate = qFromLittleEndian<quint32>(head + 24);
+    quint16 bits = qFromLittleEndian<quint16>(head + 34);
+    quint32 dataBytes = qMin<quint32>(qFromLittleEndian<quint32>(head + 40), quint32(wav.size() - 44));
+    check(formatTag == 1 && bits == 16, QString("输出保持解码器的S16格式（tag %1，%2位）").arg(formatTag).arg(bits));
+    check(channels == 2 && rate == quint32(sampleRate), QString("声道和采样率不变（%1声道 %2 Hz）").arg(channels).arg(rate));
+    if (formatTag != 1 || bits != 16 || channels != 2 || rate != quint32(sampleRate))
+        return;
+
+    qint64 frames = dataBytes / 4;
+    qint64 expected = qint64(clipSeconds) * sampleRate;
+    check(frames >= expected * 9 / 10 && frames <= expected * 11 / 10,
+          QString("输出长度与片段一致（%1 / %2 帧）").arg(frames).arg(expected));
+
+    const qint16 *samples = reinterpret_cast<const qint16 *>(wav.constData() + 44);
+    qint64 first = sampleRate / 2;
+    qint64 last = frames - sampleRate / 2;
+    if (last - first < sampleRate) {
+        check(false, "输出足够长，可以测量幅度");
+        return;
+    }
+    int peak = 0;
+    qint64 crossings = 0;
+    for (qint64 i = first; i < last; ++i) {
+        qint16 left = qFromLittleEndian<qint16>(samples[2 * i]);
+        peak = qMax(peak, qAbs(int(left)));
+        if (i > first && (qFromLittleEndian<qint16>(samples[2 * (i - 1)]) < 0) != (left < 0))
+            ++crossings;
+    }
+    double expectedPeak = amplitude * std::pow(10.0, gainDb / 20.0);
+    double measuredFrequency = crossings / 2.0 / (double(last - first) / sampleRate);
+    check(qAbs(peak - expectedPeak) <= expectedPeak * 0.1,
+          QString("幅度按增益缩放（%1，期望%2）").arg(peak).arg(expectedPeak, 0, 'f', 0));
+    check(qAbs(measuredFrequency - frequency) <= frequency * 0.02,
+          QString("正弦频率不变（%1 Hz）").arg(measuredFrequency, 0, 'f', 1));
+}
+
+void GainTestRunner::finish()
+{
+    phase = Done;
+    timer->stop();
+    if (player)
+        player->stop();
+    bool ok = failures.isEmpty();
+    printf("gain: %s  通过 %d 项  失败 %lld 项\n", ok ? "通过" : "失败", passed, qint64(failures.size()));
+    fflush(stdout);
+    emit finished(ok ? 0 : 1);
+}
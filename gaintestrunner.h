@@ -0,0 +1,62 @@
+#ifndef GAINTESTRUNNER_H
+#define GAINTESTRUNNER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QStringList>
+#include <QString>
+#include <QDebug>
+
+class VideoPlayer;
+
+//响度增益测试：合成片段的音频是S16 PCM，先分析出不为0的归一化增益，再带着增益播放到WAV文件，
+//检查输出仍是解码器的S16格式、长度与片段一致，正弦的幅度等于原幅度乘以增益、频率不变。
+//全部通过返回0，任一项失败返回1，无法准备环境返回2
+class GainTestRunner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit GainTestRunner(QObject *parent = nullptr);
+    ~GainTestRunner();
+
+    void start();
+
+    static const int clipSeconds = 6;
+    static const int sampleRate = 48000;        //与SoakRunner::writeSyntheticClip一致
+    static const int amplitude = 8000;
+    static constexpr double frequency = 440.0;
+    static const int phaseTimeoutMs = 30000;
+
+signals:
+    void finished(int exitCode);
+
+private slots:
+    void tick();
+
+private:
+    enum Phase{
+        Analyzing,          //等待响度分析完成，得到增益
+        Playing,            //带增益播放到WAV，等待结束
+        Done
+    };
+
+    void enterPhase(Phase next);
+    void check(bool ok, const QString &what);
+    void checkWav();
+    void finish();
+
+    QTemporaryDir tempDir;
+    QString clipPath;
+    QString wavPath;
+    VideoPlayer *player=nullptr;
+    QTimer *timer=nullptr;
+    QElapsedTimer phaseClock;
+    Phase phase=Analyzing;
+    QStringList failures;
+    int passed=0;
+    double gainDb=0;
+};
+
+#endif // GAINTESTRUNNER_H
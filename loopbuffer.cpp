@@ -0,0 +1,484 @@
+#include "loopbuffer.h"
+#include "sampleconvert.h"
+#include "probecache.h"
+#include "audiograph.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/channel_layout.h>
+}
+
+LoopBuffer::LoopBuffer(QObject *parent)
+    : QThread(parent){
+
+}
+
+LoopBuffer::~LoopBuffer() {
+    stop();
+    wait();
+    clearQueues();
+}
+
+//设置循环区间，需在start()之前调用；speed与音频线程当前的atempo一致
+void LoopBuffer::setJob(const QString &file, int video, int audio,
+                        qint64 a, qint64 b, double s, qint64 budget)
+{
+    fileName=file;
+    videoStream=video;
+    audioStream=audio;
+    loopA=a;
+    loopB=b;
+    speed=s>0?s:1.0;
+    budgetBytes=budget;
+}
+
+void LoopBuffer::stop()
+{
+    stopFlag=true;
+    QMutexLocker locker(&mutex);
+    condition.wakeAll();
+}
+
+void LoopBuffer::rewind(int s)
+{
+    QMutexLocker locker(&mutex);
+    serial=s;
+    rewindPending=true;
+    condition.wakeAll();
+}
+
+//取出指定代数的一帧，其它代数的帧直接丢弃
+bool LoopBuffer::takeVideo(int s, VideoFrame &frame)
+{
+    QMutexLocker locker(&mutex);
+    while(!videoOut.empty()){
+        VideoFrame item=std::move(videoOut.front());
+        videoOut.pop_front();
+        if(item.serial==s){
+            frame=std::move(item);
+            condition.wakeAll();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LoopBuffer::takeAudio(int s, AudioData &data)
+{
+    QMutexLocker locker(&mutex);
+    while(!audioOut.isEmpty()){
+        AudioData item=audioOut.dequeue();
+        audioOutMs-=item.duration;
+        if(item.serial==s){
+            data=item;
+            condition.wakeAll();
+            return true;
+        }
+    }
+    return false;
+}
+
+//调用者持有mutex
+void LoopBuffer::clearQueues()
+{
+    videoOut.clear();
+    audioOut.clear();
+    audioOutMs=0;
+}
+
+//第二个解复用/解码实例，优先使用探测缓存
+bool LoopBuffer::open()
+{
+    ProbeEntry probeEntry;
+    bool cached=ProbeCache::load(fileName,probeEntry);
+    AVInputFormat *inputFormat=cached?av_find_input_format(probeEntry.formatName.toLatin1().constData()):nullptr;
+    if(avformat_open_input(&fmtCtx,fileName.toStdString().c_str(),inputFormat,nullptr)<0){
+        qWarning()<<"循环：无法打开文件";
+        return false;
+    }
+    if((!cached||!ProbeCache::apply(fmtCtx,probeEntry))&&avformat_find_stream_info(fmtCtx,nullptr)<0){
+        qWarning()<<"循环：无法获取流信息";
+        return false;
+    }
+    if(videoStream<0||videoStream>=int(fmtCtx->nb_streams)
+        ||audioStream<0||audioStream>=int(fmtCtx->nb_streams)){
+        return false;
+    }
+
+    AVCodecContext **contexts[2]={&videoCtx,&audioCtx};
+    int streams[2]={videoStream,audioStream};
+    for(int i=0;i<2;++i){
+        AVStream *st=fmtCtx->streams[streams[i]];
+        AVCodec *codec=avcodec_find_decoder(st->codecpar->codec_id);
+        if(!codec){
+            qWarning()<<"循环：未找到解码器";
+            return false;
+        }
+        AVCodecContext *ctx=avcodec_alloc_context3(codec);
+        *contexts[i]=ctx;
+        if(!ctx||avcodec_parameters_to_context(ctx,st->codecpar)<0){
+            return false;
+        }
+        ctx->pkt_timebase=st->time_base;
+        ctx->thread_count=0;
+        if(avcodec_open2(ctx,codec,nullptr)<0){
+            qWarning()<<"循环：无法打开解码器";
+            return false;
+        }
+    }
+    if(!audioCtx->channel_layout)
+        audioCtx->channel_layout=av_get_default_channel_layout(audioCtx->channels);
+
+    //其余的流不需要读取
+    for(unsigned int i=0;i<fmtCtx->nb_streams;++i){
+        if(int(i)!=videoStream&&int(i)!=audioStream){
+            fmtCtx->streams[i]->discard=AVDISCARD_ALL;
+        }
+    }
+    return initAudioFilter();
+}
+
+void LoopBuffer::close()
+{
+    tailFrame.reset();
+    avfilter_graph_free(&graph);
+    avcodec_free_context(&videoCtx);
+    avcodec_free_context(&audioCtx);
+    avformat_close_input(&fmtCtx);
+}
+
+//atrim精确裁出[A,B)，volume和atempo与播放时的音频滤镜相同，输出同样固定为解码器的采样格式
+bool LoopBuffer::initAudioFilter()
+{
+    char descr[256];
+    char volume[32] = "";
+    AVStream *st = fmtCtx->streams[audioStream];
+
+    if (qAbs(gainDb) >= 0.01)
+        snprintf(volume, sizeof(volume), "volume=%.2fdB,", gainDb);
+    snprintf(descr, sizeof(descr), "atrim=start=%.6f:end=%.6f,%satempo=%.1f",
+             loopA / 1000.0, loopB / 1000.0, volume, speed);
+    if (createAudioFilterGraph(audioCtx, st->time_base, descr, audioCtx->sample_fmt, &graph, &src, &sink) < 0) {
+        qWarning() << "循环：无法初始化音频滤镜";
+        return false;
+    }
+    return true;
+}
+
+//滤镜输出转换为交错PCM，pts按已输出的样本数累计，保证首尾样本精确衔接
+void LoopBuffer::appendAudio(AVFrame *filtered)
+{
+    int size=SampleConvert::outputBytes(filtered);
+    if(size<=0||filtered->sample_rate<=0){
+        return;
+    }
+    AudioData data;
+    data.buffer=QByteArray(size,Qt::Uninitialized);
+    if(SampleConvert::convert(filtered,(uint8_t*)data.buffer.data())<0){
+        return;
+    }
+    data.pts=loopA+qint64(producedAudioMs);
+    data.duration=filtered->nb_samples*1000.0/filtered->sample_rate;
+    producedAudioMs+=filtered->nb_samples*1000.0*speed/filtered->sample_rate;
+    headBytes+=size;
+    headAudio.append(data);
+}
+
+//预解码：PCM解完整个区间，视频帧在预算内尽量多缓存
+bool LoopBuffer::predecode()
+{
+    AVStream *vst=fmtCtx->streams[videoStream];
+    if(avformat_seek_file(fmtCtx,-1,INT64_MIN,loopA*1000,loopA*1000,0)<0){
+        qWarning()<<"循环：无法跳转到A点";
+        return false;
+    }
+
+    PacketPtr packetHandle=makePacket();
+    FramePtr frameHandle=makeFrame();
+    FramePtr filteredHandle=makeFrame();
+    AVPacket *packet=packetHandle.get();
+    AVFrame *frame=frameHandle.get();
+    AVFrame *filtered=filteredHandle.get();
+    if(!packet||!frame||!filtered){
+        return false;
+    }
+    bool videoDone=false;
+    bool audioDone=false;
+    bool budgetHit=false;
+    bool ok=true;
+
+    while(!stopFlag&&!(videoDone&&audioDone)){
+        int ret=av_read_frame(fmtCtx,packet);
+        bool eof=ret<0;
+        AVPacket *input=eof?nullptr:packet;
+
+        if(!videoDone&&(eof||packet->stream_index==videoStream)){
+            avcodec_send_packet(videoCtx,input);
+            while(avcodec_receive_frame(videoCtx,frame)>=0){
+                qint64 ms=frame->best_effort_timestamp==AV_NOPTS_VALUE?loopA
+                            :qint64(frame->best_effort_timestamp*av_q2d(vst->time_base)*1000);
+                if(ms<loopA||videoDone){
+                    av_frame_unref(frame);
+                    continue;
+                }
+                if(ms>=loopB){
+                    videoDone=true;
+                    av_frame_unref(frame);
+                    continue;
+                }
+                int bytes=av_image_get_buffer_size((AVPixelFormat)frame->format,frame->width,frame->height,1);
+                if(headBytes+bytes>budgetBytes){
+                    //超出预算，之后的部分播放时由解码器边解边输出
+                    budgetHit=true;
+                    videoDone=true;
+                    av_frame_unref(frame);
+                    continue;
+                }
+                headBytes+=bytes;
+                headVideoEnd=frame->best_effort_timestamp;
+                FramePtr cached=makeFrame();
+                if(cached){
+                    av_frame_move_ref(cached.get(),frame);
+                    headVideo.push_back(std::move(cached));
+                }else{
+                    av_frame_unref(frame);
+                }
+            }
+        }
+
+        if(!audioDone&&(eof||packet->stream_index==audioStream)){
+            avcodec_send_packet(audioCtx,input);
+            while(avcodec_receive_frame(audioCtx,frame)>=0){
+                if(frame->pts==AV_NOPTS_VALUE)
+                    frame->pts=frame->best_effort_timestamp;
+                qint64 ms=frame->pts==AV_NOPTS_VALUE?loopA
+                            :qint64(frame->pts*av_q2d(fmtCtx->streams[audioStream]->time_base)*1000);
+                av_buffersrc_add_frame(src,frame);
+                av_frame_unref(frame);
+                if(ms>=loopB){
+                    audioDone=true;
+                }
+            }
+            if(eof||audioDone){
+                av_buffersrc_add_frame(src,nullptr);   //冲刷atempo中剩余的样本
+                audioDone=true;
+            }
+            while(av_buffersink_get_frame(sink,filtered)>=0){
+                appendAudio(filtered);
+                av_frame_unref(filtered);
+            }
+        }
+
+        if(!eof){
+            av_packet_unref(packet);
+        }else{
+            videoDone=true;
+            audioDone=true;
+        }
+        if(headBytes>budgetBytes&&!budgetHit){
+            qWarning()<<"循环：区间的PCM超出内存预算";
+            ok=false;
+            break;
+        }
+    }
+
+    if(!ok||stopFlag||headVideo.empty()||headAudio.isEmpty()){
+        return false;
+    }
+
+    memoryMode=!budgetHit;
+    //之后只读取视频，PCM已全部在内存中
+    fmtCtx->streams[audioStream]->discard=AVDISCARD_ALL;
+    return true;
+}
+
+//从解码器取下一帧，需要时继续读包；文件结束返回false
+bool LoopBuffer::decodeVideoFrame(AVFrame *frame)
+{
+    PacketPtr packet=makePacket();
+    bool got=false;
+    while(!stopFlag){
+        int ret=avcodec_receive_frame(videoCtx,frame);
+        if(ret>=0){
+            got=true;
+            break;
+        }
+        if(ret!=AVERROR(EAGAIN)){
+            break;
+        }
+        if(!packet||av_read_frame(fmtCtx,packet.get())<0){
+            if(videoEofSent){
+                break;
+            }
+            avcodec_send_packet(videoCtx,nullptr);
+            videoEofSent=true;
+            continue;
+        }
+        if(packet->stream_index==videoStream){
+            avcodec_send_packet(videoCtx,packet.get());
+        }
+        av_packet_unref(packet.get());
+    }
+    return got;
+}
+
+//准备下一圈的后半段：seek到缓存末尾之前的关键帧，解到缓存末尾为止
+void LoopBuffer::startTail()
+{
+    tailFrame.reset();
+    tailState=TailSeeking;
+    tailSeekIssued=false;
+}
+
+//每次推进一帧，在前半段从内存输出的同时完成，避免回到A点时等待
+void LoopBuffer::advanceTail()
+{
+    if(tailState!=TailSeeking){
+        return;
+    }
+    if(!tailSeekIssued){
+        avformat_seek_file(fmtCtx,videoStream,INT64_MIN,headVideoEnd,headVideoEnd,0);
+        avcodec_flush_buffers(videoCtx);
+        videoEofSent=false;
+        tailSeekIssued=true;
+        return;
+    }
+    FramePtr frame=makeFrame();
+    if(!frame||!decodeVideoFrame(frame.get())){
+        tailState=TailReady;        //tailFrame为空表示这一圈没有后半段
+        return;
+    }
+    if(frame->best_effort_timestamp!=AV_NOPTS_VALUE&&frame->best_effort_timestamp<=headVideoEnd){
+        return;
+    }
+    tailFrame=std::move(frame);
+    tailState=TailReady;
+}
+
+//输出第iteration圈的一帧，时间戳加上iteration*(B-A)
+void LoopBuffer::pushVideo(FramePtr frame, int iteration)
+{
+    if(!frame){
+        return;
+    }
+    AVRational tb=fmtCtx->streams[videoStream]->time_base;
+    qint64 offset=av_rescale_q(iteration*(loopB-loopA),AVRational{1,1000},tb);
+    frame->best_effort_timestamp+=offset;
+    frame->pts=frame->best_effort_timestamp;
+    qint64 ms=frame->best_effort_timestamp*av_q2d(tb)*1000;
+
+    QMutexLocker locker(&mutex);
+    if(rewindPending){
+        return;
+    }
+    videoOut.push_back(VideoFrame{std::move(frame),ms,serial});
+}
+
+//循环输出，音频和视频各自有游标，一方队列满时不影响另一方
+void LoopBuffer::serve()
+{
+    int videoIteration=1;
+    int audioIteration=1;
+    int videoCursor=0;
+    int audioCursor=0;
+    bool tailActive=false;      //正在输出后半段
+    if(!memoryMode){
+        startTail();
+    }
+
+    while(!stopFlag){
+        bool worked=false;
+        bool videoSpace;
+        {
+            QMutexLocker locker(&mutex);
+            if(rewindPending){
+                clearQueues();
+                rewindPending=false;
+                videoIteration=1;
+                audioIteration=1;
+                videoCursor=0;
+                audioCursor=0;
+                //后半段输出到一半时需要重新seek，已准备好的下一圈后半段可以继续使用
+                if(tailActive&&!memoryMode){
+                    startTail();
+                }
+                tailActive=false;
+            }
+
+            if(audioOutMs<maxQueuedAudioMs){
+                AudioData data=headAudio.at(audioCursor);
+                data.pts+=audioIteration*(loopB-loopA);
+                data.serial=serial;
+                audioOut.enqueue(data);
+                audioOutMs+=data.duration;
+                if(++audioCursor==headAudio.size()){
+                    audioCursor=0;
+                    ++audioIteration;
+                }
+                worked=true;
+            }
+            videoSpace=int(videoOut.size())<maxQueuedFrames;
+        }
+
+        if(videoSpace){
+            if(!tailActive&&videoCursor<int(headVideo.size())){
+                pushVideo(FramePtr(av_frame_clone(headVideo.at(videoCursor).get())),videoIteration);
+                ++videoCursor;
+                worked=true;
+            }else if(memoryMode){
+                videoCursor=0;
+                ++videoIteration;
+                worked=true;
+            }else if(tailState!=TailReady){
+                advanceTail();
+                worked=true;
+            }else{
+                tailActive=true;
+                FramePtr frame=std::move(tailFrame);
+                qint64 endTs=av_rescale_q(loopB,AVRational{1,1000},fmtCtx->streams[videoStream]->time_base);
+                if(frame&&(frame->best_effort_timestamp==AV_NOPTS_VALUE||frame->best_effort_timestamp<endTs)){
+                    pushVideo(std::move(frame),videoIteration);
+                    FramePtr next=makeFrame();
+                    if(next&&decodeVideoFrame(next.get())){
+                        tailFrame=std::move(next);
+                    }
+                }
+                //这一圈结束，立即为下一圈提前seek
+                if(!tailFrame){
+                    tailActive=false;
+                    videoCursor=0;
+                    ++videoIteration;
+                    startTail();
+                }
+                worked=true;
+            }
+        }else if(!memoryMode&&tailState==TailSeeking){
+            //队列已满时利用空闲推进下一圈后半段的seek
+            advanceTail();
+            worked=true;
+        }
+
+        if(!worked){
+            QMutexLocker locker(&mutex);
+            if(!rewindPending&&!stopFlag){
+                condition.wait(&mutex,100);
+            }
+        }
+    }
+}
+
+//循环线程入口
+void LoopBuffer::run()
+{
+    if(open()&&predecode()){
+        ready=true;
+        emit loopReady(memoryMode);
+        qDebug()<<"循环缓冲就绪"<<loopA<<loopB<<(memoryMode?"全部在内存中":"超出预算，后半段边播边解")
+                <<"缓存"<<headBytes/1024<<"KB";
+        serve();
+    }else if(!stopFlag){
+        emit loopFailed();
+    }
+    close();
+}
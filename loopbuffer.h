@@ -0,0 +1,139 @@
+#ifndef LOOPBUFFER_H
+#define LOOPBUFFER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QByteArray>
+#include <QString>
+#include <QDebug>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "videofilter.h"
+#include "avhandles.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+}
+
+//交错PCM块，pts和duration为毫秒；duration不取整，逐块累加时不会漂移
+struct AudioData{
+    QByteArray buffer;
+    qint64 pts;
+    double duration;
+    int serial=0;
+};
+
+//A-B循环缓冲：用独立的解复用/解码实例预先解码[A,B)区间的视频帧和经过atempo的PCM，
+//播放越过B点后由本线程按"第k圈"把时间戳加上k*(B-A)循环输出，时间轴单调递增，回到A点没有缝隙。
+//区间的视频超过内存预算时只缓存开头部分，其余部分由提前seek好的解码器边播边解
+class LoopBuffer : public QThread
+{
+    Q_OBJECT
+public:
+    explicit LoopBuffer(QObject *parent = nullptr);
+    ~LoopBuffer();
+
+    void setJob(const QString &fileName, int videoStream, int audioStream,
+                qint64 loopA, qint64 loopB, double speed, qint64 budgetBytes);
+    //响度归一化增益，与音频线程一致，需在start()之前调用
+    void setGain(double db){
+        gainDb=db;
+    }
+    void run() override;
+    void stop();
+
+    //从第1圈重新开始输出，之后只输出该代数的数据
+    void rewind(int serial);
+    bool takeVideo(int serial, VideoFrame &frame);
+    bool takeAudio(int serial, AudioData &data);
+
+    bool isReady() const{
+        return ready.load();
+    }
+    bool inMemory() const{
+        return memoryMode.load();
+    }
+    qint64 loopStart() const{
+        return loopA;
+    }
+    qint64 loopEnd() const{
+        return loopB;
+    }
+
+    static const int maxQueuedFrames = 32;
+    static const int maxQueuedAudioMs = 3000;
+
+signals:
+    void loopReady(bool inMemory);
+    void loopFailed();
+
+private:
+    enum TailState{
+        TailIdle,
+        TailSeeking,
+        TailReady
+    };
+
+    bool open();
+    void close();
+    bool initAudioFilter();
+    bool predecode();
+    void serve();
+    void appendAudio(AVFrame *filtered);
+    bool decodeVideoFrame(AVFrame *frame);
+    void startTail();
+    void advanceTail();
+    void pushVideo(FramePtr frame, int iteration);
+    void clearQueues();
+
+    QString fileName;
+    int videoStream=-1;
+    int audioStream=-1;
+    qint64 loopA=0;
+    qint64 loopB=0;
+    double speed=1.0;
+    double gainDb=0;
+    qint64 budgetBytes=0;
+
+    AVFormatContext *fmtCtx=nullptr;
+    AVCodecContext *videoCtx=nullptr;
+    AVCodecContext *audioCtx=nullptr;
+    AVFilterGraph *graph=nullptr;
+    AVFilterContext *src=nullptr;
+    AVFilterContext *sink=nullptr;
+
+    std::vector<FramePtr> headVideo; //区间开头已解码的视频帧
+    QVector<AudioData> headAudio;    //整个区间的PCM
+    qint64 headVideoEnd=AV_NOPTS_VALUE;
+    qint64 headBytes=0;
+    double producedAudioMs=0;        //已输出PCM对应的媒体时长
+
+    TailState tailState=TailIdle;
+    bool tailSeekIssued=false;
+    bool videoEofSent=false;
+    FramePtr tailFrame;
+
+    QMutex mutex;
+    QWaitCondition condition;
+    std::deque<VideoFrame> videoOut;
+    QQueue<AudioData> audioOut;
+    double audioOutMs=0;
+    int serial=0;
+    bool rewindPending=false;
+
+    std::atomic<bool> stopFlag{false};
+    std::atomic<bool> ready{false};
+    std::atomic<bool> memoryMode{false};
+};
+
+#endif // LOOPBUFFER_H
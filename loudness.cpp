@@ -0,0 +1,289 @@
+#include "loudness.h"
+#include "avhandles.h"
+#include <QSettings>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QUrl>
+#include <cmath>
+#include <climits>
+#include <cstdlib>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/dict.h>
+}
+
+//qml传入的可能是file:///形式的url，转换为本地路径
+static QString localPath(const QString &fileName)
+{
+    QUrl url(fileName);
+    return url.isLocalFile()?url.toLocalFile():fileName;
+}
+
+static QString cacheKey(const QString &fileName)
+{
+    QString path=QFileInfo(localPath(fileName)).absoluteFilePath();
+    return QString::fromLatin1(QCryptographicHash::hash(path.toUtf8(),QCryptographicHash::Sha1).toHex());
+}
+
+static QString cacheFile()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)+"/loudness.ini";
+}
+
+bool LoudnessCache::load(const QString &fileName, LoudnessResult &result)
+{
+    QFileInfo info(localPath(fileName));
+    if(!info.exists()){
+        return false;
+    }
+    QSettings settings(cacheFile(),QSettings::IniFormat);
+    settings.beginGroup(cacheKey(fileName));
+    bool valid=settings.contains("integrated")
+                 &&settings.value("size").toLongLong()==info.size()
+                 &&settings.value("mtime").toLongLong()==info.lastModified().toMSecsSinceEpoch();
+    if(valid){
+        result.integrated=settings.value("integrated").toDouble();
+        result.truePeak=settings.value("truePeak").toDouble();
+        settings.setValue("used",QDateTime::currentMSecsSinceEpoch());
+    }
+    settings.endGroup();
+    return valid;
+}
+
+//写入一条结果，超过上限时删除最久没有使用的条目
+void LoudnessCache::save(const QString &fileName, const LoudnessResult &result)
+{
+    QFileInfo info(localPath(fileName));
+    QSettings settings(cacheFile(),QSettings::IniFormat);
+    settings.beginGroup(cacheKey(fileName));
+    settings.setValue("size",info.size());
+    settings.setValue("mtime",info.lastModified().toMSecsSinceEpoch());
+    settings.setValue("integrated",result.integrated);
+    settings.setValue("truePeak",result.truePeak);
+    settings.setValue("used",QDateTime::currentMSecsSinceEpoch());
+    settings.endGroup();
+
+    QStringList groups=settings.childGroups();
+    while(groups.size()>maxEntries){
+        QString oldest;
+        qint64 oldestUsed=LLONG_MAX;
+        for(const QString &group:groups){
+            qint64 used=settings.value(group+"/used").toLongLong();
+            if(used<oldestUsed){
+                oldestUsed=used;
+                oldest=group;
+            }
+        }
+        settings.remove(oldest);
+        groups.removeOne(oldest);
+    }
+}
+
+double LoudnessCache::gainFor(const LoudnessResult &result, double target)
+{
+    double gain=target-result.integrated;
+    gain=qMin(gain,peakCeiling-result.truePeak);
+    return qBound(-maxGainDb,gain,maxGainDb);
+}
+
+LoudnessAnalyzer::LoudnessAnalyzer(QObject *parent)
+    : QThread(parent){
+
+}
+
+LoudnessAnalyzer::~LoudnessAnalyzer() {
+    cancel();
+    wait();
+}
+
+void LoudnessAnalyzer::setJob(const QString &file, int stream)
+{
+    fileName=file;
+    audioStream=stream;
+    cancelFlag=false;
+    integrated=0;
+    truePeakLinear=0;
+    measured=false;
+    mediaSeconds=0;
+}
+
+void LoudnessAnalyzer::cancel()
+{
+    cancelFlag=true;
+}
+
+//只解码音频，其余的流在解复用时直接丢弃
+bool LoudnessAnalyzer::open()
+{
+    if(avformat_open_input(&fmtCtx,fileName.toStdString().c_str(),nullptr,nullptr)<0){
+        qWarning()<<"响度分析：无法打开文件";
+        return false;
+    }
+    if(avformat_find_stream_info(fmtCtx,nullptr)<0){
+        qWarning()<<"响度分析：无法获取流信息";
+        return false;
+    }
+    if(audioStream<0||audioStream>=int(fmtCtx->nb_streams)){
+        audioStream=av_find_best_stream(fmtCtx,AVMEDIA_TYPE_AUDIO,-1,-1,nullptr,0);
+        if(audioStream<0){
+            return false;
+        }
+    }
+    for(unsigned int i=0;i<fmtCtx->nb_streams;++i){
+        if(int(i)!=audioStream){
+            fmtCtx->streams[i]->discard=AVDISCARD_ALL;
+        }
+    }
+
+    AVStream *st=fmtCtx->streams[audioStream];
+    AVCodec *codec=avcodec_find_decoder(st->codecpar->codec_id);
+    if(!codec){
+        qWarning()<<"响度分析：未找到音频解码器";
+        return false;
+    }
+    decCtx=avcodec_alloc_context3(codec);
+    if(!decCtx||avcodec_parameters_to_context(decCtx,st->codecpar)<0){
+        return false;
+    }
+    decCtx->pkt_timebase=st->time_base;
+    if(avcodec_open2(decCtx,codec,nullptr)<0){
+        qWarning()<<"响度分析：无法打开音频解码器";
+        return false;
+    }
+    if(!decCtx->channel_layout)
+        decCtx->channel_layout=av_get_default_channel_layout(decCtx->channels);
+    return initFilter();
+}
+
+//ebur128的测量值通过帧的metadata输出，peak=true时同时计算真峰值
+bool LoudnessAnalyzer::initFilter()
+{
+    char args[512];
+    int ret = 0;
+    AVStream *st = fmtCtx->streams[audioStream];
+    const AVFilter *buffersrc  = avfilter_get_by_name("abuffer");
+    const AVFilter *buffersink = avfilter_get_by_name("abuffersink");
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterInOut *inputs  = avfilter_inout_alloc();
+
+    graph = avfilter_graph_alloc();
+    if (!outputs || !inputs || !graph) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    snprintf(args, sizeof(args),
+             "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%" PRIx64,
+             st->time_base.num, st->time_base.den, decCtx->sample_rate,
+             av_get_sample_fmt_name(decCtx->sample_fmt), decCtx->channel_layout);
+    ret = avfilter_graph_create_filter(&src, buffersrc, "in", args, nullptr, graph);
+    if (ret < 0)
+        goto end;
+    ret = avfilter_graph_create_filter(&sink, buffersink, "out", nullptr, nullptr, graph);
+    if (ret < 0)
+        goto end;
+
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = src;
+    outputs->pad_idx    = 0;
+    outputs->next       = nullptr;
+
+    inputs->name       = av_strdup("out");
+    inputs->filter_ctx = sink;
+    inputs->pad_idx    = 0;
+    inputs->next       = nullptr;
+
+    if ((ret = avfilter_graph_parse_ptr(graph, "ebur128=peak=true:metadata=1", &inputs, &outputs, nullptr)) < 0)
+        goto end;
+    if ((ret = avfilter_graph_config(graph, nullptr)) < 0)
+        goto end;
+
+end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    if (ret < 0) {
+        qWarning() << "响度分析：无法初始化ebur128滤镜";
+        avfilter_graph_free(&graph);
+        return false;
+    }
+    return true;
+}
+
+//metadata中的I是到当前为止的综合响度，true_peaks_chN是各声道到当前为止的最大真峰值（线性）
+void LoudnessAnalyzer::collect(AVFrame *frame)
+{
+    if(frame->sample_rate>0){
+        mediaSeconds+=double(frame->nb_samples)/frame->sample_rate;
+    }
+    AVDictionaryEntry *entry=av_dict_get(frame->metadata,"lavfi.r128.I",nullptr,0);
+    if(entry){
+        integrated=atof(entry->value);
+        measured=true;
+    }
+    entry=nullptr;
+    while((entry=av_dict_get(frame->metadata,"lavfi.r128.true_peaks_ch",entry,AV_DICT_IGNORE_SUFFIX))){
+        truePeakLinear=qMax(truePeakLinear,atof(entry->value));
+    }
+}
+
+void LoudnessAnalyzer::close()
+{
+    avfilter_graph_free(&graph);
+    avcodec_free_context(&decCtx);
+    avformat_close_input(&fmtCtx);
+}
+
+//分析线程入口：读完整个音频流后发出结果
+void LoudnessAnalyzer::run()
+{
+    QElapsedTimer clock;
+    clock.start();
+    bool ok=open();
+
+    PacketPtr packet=makePacket();
+    FramePtr frame=makeFrame();
+    FramePtr filtered=makeFrame();
+    ok=ok&&packet&&frame&&filtered;
+
+    bool eof=false;
+    while(ok&&!eof&&!cancelFlag){
+        if(av_read_frame(fmtCtx,packet.get())<0){
+            eof=true;
+            avcodec_send_packet(decCtx,nullptr);
+        }else{
+            if(packet->stream_index==audioStream){
+                avcodec_send_packet(decCtx,packet.get());
+            }
+            av_packet_unref(packet.get());
+        }
+        while(avcodec_receive_frame(decCtx,frame.get())>=0){
+            if(frame->pts==AV_NOPTS_VALUE)
+                frame->pts=frame->best_effort_timestamp;
+            av_buffersrc_add_frame(src,frame.get());
+            av_frame_unref(frame.get());
+        }
+        if(eof){
+            av_buffersrc_add_frame(src,nullptr);
+        }
+        while(av_buffersink_get_frame(sink,filtered.get())>=0){
+            collect(filtered.get());
+            av_frame_unref(filtered.get());
+        }
+    }
+    close();
+
+    qint64 elapsed=clock.elapsed();
+    ok=ok&&!cancelFlag&&measured&&std::isfinite(integrated)&&integrated>-70;
+    double truePeak=truePeakLinear>0?20*std::log10(truePeakLinear):-100;
+    double speed=elapsed>0?mediaSeconds*1000/elapsed:0;
+    if(ok){
+        qDebug()<<"响度分析完成"<<integrated<<"LUFS，真峰值"<<truePeak<<"dBTP，"<<speed<<"倍实时";
+    }
+    if(!cancelFlag){
+        emit analysisFinished(fileName,ok,integrated,truePeak,speed,elapsed);
+    }
+}
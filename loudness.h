@@ -0,0 +1,78 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <QObject>
+#include <QThread>
+#include <QString>
+#include <QDebug>
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+}
+
+//一个文件的EBU R128测量结果
+struct LoudnessResult{
+    double integrated=0;     //综合响度(LUFS)
+    double truePeak=0;       //真峰值(dBTP)
+};
+
+//响度缓存：所有文件的结果存在一个小的ini文件中，文件大小或修改时间变化后失效
+class LoudnessCache
+{
+public:
+    static bool load(const QString &fileName, LoudnessResult &result);
+    static void save(const QString &fileName, const LoudnessResult &result);
+
+    //把响度调整到target(LUFS)所需的增益，同时保证真峰值不超过peakCeiling(dBTP)
+    static double gainFor(const LoudnessResult &result, double target);
+
+    static const int maxEntries = 1000;
+    static constexpr double peakCeiling = -1.0;
+    static constexpr double maxGainDb = 20.0;
+};
+
+//响度分析线程：独立的解复用/解码实例，只读取音频流，经ebur128滤镜尽可能快地测量整个文件
+class LoudnessAnalyzer : public QThread
+{
+    Q_OBJECT
+public:
+    explicit LoudnessAnalyzer(QObject *parent = nullptr);
+    ~LoudnessAnalyzer();
+
+    void setJob(const QString &fileName, int audioStream);
+    void cancel();
+
+    void run() override;
+
+signals:
+    //speed为分析速度相对实时的倍数
+    void analysisFinished(const QString &fileName, bool ok, double integrated, double truePeak, double speed, qint64 elapsedMs);
+
+private:
+    bool open();
+    bool initFilter();
+    void collect(AVFrame *frame);
+    void close();
+
+    QString fileName;
+    int audioStream=-1;
+    std::atomic<bool> cancelFlag{false};
+
+    AVFormatContext *fmtCtx=nullptr;
+    AVCodecContext *decCtx=nullptr;
+    AVFilterGraph *graph=nullptr;
+    AVFilterContext *src=nullptr;
+    AVFilterContext *sink=nullptr;
+
+    double integrated=0;
+    double truePeakLinear=0;
+    bool measured=false;
+    double mediaSeconds=0;
+};
+
+#endif // LOUDNESS_H
@@ -1,10 +1,59 @@
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include "sampleconvert.h"
+#include "soakrunner.h"
+#include "nettestrunner.h"
+#include "gaintestrunner.h"
 
 int main(int argc, char *argv[])
 {
+    //采样格式转换微基准，不启动界面
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bench-sample-convert") == 0) {
+            printf("%s\n", qPrintable(SampleConvert::benchmark()));
+            return 0;
+        }
+    }
+
     QGuiApplication app(argc, argv);
 
+    //内存浸泡测试：--soak [分钟]，不加载界面，RSS增长超过上限时返回1
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--soak") == 0) {
+            int minutes = i + 1 < argc ? atoi(argv[i + 1]) : 60;
+            SoakRunner runner(minutes);
+            QObject::connect(&runner, &SoakRunner::finished, &app, [](int code) { QCoreApplication::exit(code); },
+                             Qt::QueuedConnection);
+            runner.start();
+            return app.exec();
+        }
+    }
+
+    //网络输入测试：--net-test，本地HTTP服务器提供片段和HLS，检查续传、溢出、水位和缓存命中，失败时返回1
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--net-test") == 0) {
+            NetTestRunner runner;
+            QObject::connect(&runner, &NetTestRunner::finished, &app, [](int code) { QCoreApplication::exit(code); },
+                             Qt::QueuedConnection);
+            runner.start();
+            return app.exec();
+        }
+    }
+
+    //响度增益测试：--gain-test，S16片段带归一化增益播放到WAV，检查格式、幅度和频率，失败时返回1
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--gain-test") == 0) {
+            GainTestRunner runner;
+            QObject::connect(&runner, &GainTestRunner::finished, &app, [](int code) { QCoreApplication::exit(code); },
+                             Qt::QueuedConnection);
+            runner.start();
+            return app.exec();
+        }
+    }
+
     QQmlApplicationEngine engine;
     const QUrl url(QStringLiteral("qrc:/ffmpegAudioThread/Main.qml"));
     QObject::connect(
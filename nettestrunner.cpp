@@ -0,0 +1,357 @@
+#include "nettestrunner.h"
+#include "soakrunner.h"
+#include "videoplayer.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QRegularExpression>
+#include <cstdio>
+
+//每个连接的发送缓冲上限，超出后等客户端读走再继续，限速才有意义
+static const qint64 socketBacklog = 256 * 1024;
+
+TestHttpServer::TestHttpServer(const QString &r, QObject *parent)
+    : QObject(parent),
+    root(r){
+    connect(&server, &QTcpServer::newConnection, this, &TestHttpServer::onNewConnection);
+    connect(&pumpTimer, &QTimer::timeout, this, &TestHttpServer::pump);
+}
+
+bool TestHttpServer::listen()
+{
+    if (!server.listen(QHostAddress::LocalHost, 0))
+        return false;
+    pumpClock.start();
+    pumpTimer.start(10);
+    return true;
+}
+
+QString TestHttpServer::url(const QString &path) const
+{
+    return QString("http://127.0.0.1:%1%2").arg(server.serverPort()).arg(path);
+}
+
+void TestHttpServer::setRate(qint64 bytesPerSecond)
+{
+    rate = qMax<qint64>(0, bytesPerSecond);
+}
+
+void TestHttpServer::setStalled(bool s)
+{
+    stalled = s;
+}
+
+void TestHttpServer::dropOnce(const QString &path, qint64 offset)
+{
+    dropPath = path;
+    dropOffset = offset;
+    dropDone = false;
+}
+
+int TestHttpServer::requestCount(const QString &path) const
+{
+    int count = 0;
+    for (const Request &request : m_requests) {
+        if (request.path == path)
+            ++count;
+    }
+    return count;
+}
+
+void TestHttpServer::onNewConnection()
+{
+    while (QTcpSocket *socket = server.nextPendingConnection()) {
+        connections.insert(socket, Connection());
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            auto it = connections.find(socket);
+            if (it == connections.end() || it->sending || it->file)
+                return;
+            it->header += socket->readAll();
+            if (it->header.contains("\r\n\r\n"))
+                handleRequest(socket, *it);
+        });
+        //排队处理，pump()遍历连接时不会被同步删除
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            connections.remove(socket);
+            socket->deleteLater();
+        }, Qt::QueuedConnection);
+    }
+}
+
+//只处理GET，Range只支持"bytes=N-"，这正是FFmpeg的http协议续传和seek时发出的形式
+void TestHttpServer::handleRequest(QTcpSocket *socket, Connection &c)
+{
+    QList<QByteArray> lines = c.header.split('\n');
+    QList<QByteArray> first = lines.value(0).trimmed().split(' ');
+    c.path = QString::fromUtf8(first.value(1)).section('?', 0, 0);
+
+    qint64 offset = 0;
+    bool ranged = false;
+    for (const QByteArray &raw : lines) {
+        QByteArray line = raw.trimmed();
+        if (line.toLower().startsWith("range: bytes=")) {
+            ranged = true;
+            offset = line.mid(13).split('-').value(0).toLongLong();
+        }
+    }
+    m_requests.append(Request{c.path, offset});
+
+    QFile *file = new QFile(QDir(root).filePath(c.path.mid(1)), socket);
+    if (first.value(0) != "GET" || c.path.contains("..") || !file->open(QIODevice::ReadOnly)) {
+        socket->write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+        return;
+    }
+    qint64 size = file->size();
+    if (offset >= size && size > 0) {
+        socket->write(QString("HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%1\r\n"
+                              "Content-Length: 0\r\nConnection: close\r\n\r\n").arg(size).toUtf8());
+        socket->disconnectFromHost();
+        return;
+    }
+    file->seek(offset);
+
+    QString type = c.path.endsWith(".m3u8") ? "application/vnd.apple.mpegurl"
+                   : c.path.endsWith(".ts") ? "video/mp2t" : "video/x-matroska";
+    QString head = ranged ? QString("HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %1-%2/%3\r\n")
+                                .arg(offset).arg(size - 1).arg(size)
+                          : QString("HTTP/1.1 200 OK\r\n");
+    head += QString("Accept-Ranges: bytes\r\nContent-Length: %1\r\nContent-Type: %2\r\nConnection: close\r\n\r\n")
+                .arg(size - offset).arg(type);
+    socket->write(head.toUtf8());
+
+    c.file = file;
+    c.pos = offset;
+    c.end = size;
+    c.sending = true;
+}
+
+void TestHttpServer::finishResponse(QTcpSocket *socket, Connection &c)
+{
+    c.sending = false;
+    socket->disconnectFromHost();
+}
+
+//按限速给每个连接分配本次可发送的字节数；到达断开点时只发到该偏移就关闭连接，客户端收到的长度不足Content-Length
+void TestHttpServer::pump()
+{
+    qint64 elapsed = pumpClock.restart();
+    qint64 budget = rate > 0 ? qMax<qint64>(1, rate * elapsed / 1000) : socketBacklog;
+    if (stalled)
+        return;
+
+    for (auto it = connections.begin(); it != connections.end(); ++it) {
+        QTcpSocket *socket = it.key();
+        Connection &c = it.value();
+        if (!c.sending)
+            continue;
+        qint64 allowance = budget;
+        while (allowance > 0 && c.pos < c.end && socket->bytesToWrite() < socketBacklog) {
+            qint64 chunk = qMin<qint64>(qMin<qint64>(allowance, 65536), c.end - c.pos);
+            bool drop = !dropDone && c.path == dropPath && c.pos < dropOffset && c.pos + chunk >= dropOffset;
+            if (drop)
+                chunk = dropOffset - c.pos;
+            QByteArray data = c.file->read(chunk);
+            if (data.isEmpty()) {
+                c.end = c.pos;
+                break;
+            }
+            socket->write(data);
+            c.pos += data.size();
+            allowance -= data.size();
+            if (drop) {
+                dropDone = true;
+                c.end = c.pos;
+                printf("net: 服务器在offset %lld断开%s\n", c.pos, qPrintable(c.path));
+            }
+        }
+        if (c.pos >= c.end)
+            finishResponse(socket, c);
+    }
+}
+
+NetTestRunner::NetTestRunner(QObject *parent)
+    : QObject(parent),
+    timer(new QTimer(this)){
+    connect(timer, &QTimer::timeout, this, &NetTestRunner::tick);
+}
+
+NetTestRunner::~NetTestRunner() {
+    delete player;
+}
+
+void NetTestRunner::start()
+{
+    QDir dir(tempDir.path());
+    if (!tempDir.isValid() || !dir.mkpath("hls")
+        || !SoakRunner::writeSyntheticClip(dir.filePath("clip.mkv"), clipSeconds)
+        || !SoakRunner::writeSyntheticClip(dir.filePath("hls/index.m3u8"), clipSeconds, "hls")) {
+        printf("net: 无法生成测试片段\n");
+        emit finished(2);
+        return;
+    }
+
+    server = new TestHttpServer(tempDir.path(), this);
+    if (!server->listen()) {
+        printf("net: 无法启动HTTP服务器\n");
+        emit finished(2);
+        return;
+    }
+    //限速到平均码率的1.25倍，缓冲增长很慢，暂停发送后很快跌破低水位
+    qint64 size = QFileInfo(dir.filePath("clip.mkv")).size();
+    server->setRate(size * 5 / 4 / clipSeconds);
+    server->dropOnce("/clip.mkv", dropOffset);
+
+    player = new VideoPlayer();
+    player->setAudioSink("null");
+    player->setLowWatermark(lowWatermark);
+    player->setHighWatermark(highWatermark);
+    if (!player->loadFile(server->url("/clip.mkv"))) {
+        printf("net: 打开失败\n");
+        emit finished(2);
+        return;
+    }
+    player->play();
+    enterPhase(Downloading);
+    timer->start(50);
+    printf("net: 服务器 %s  片段 %lld 字节\n", qPrintable(server->url("/")), size);
+}
+
+void NetTestRunner::enterPhase(Phase next)
+{
+    phase = next;
+    phaseClock.start();
+}
+
+void NetTestRunner::check(bool ok, const QString &what)
+{
+    if (ok) {
+        ++passed;
+    } else {
+        failures << what;
+    }
+    printf("net: %s %s\n", ok ? "通过" : "失败", qPrintable(what));
+    fflush(stdout);
+}
+
+void NetTestRunner::tick()
+{
+    static const char *phaseNames[] = {"限速下载", "暂停发送", "恢复发送", "下载剩余部分", "seek回缓存", "HLS"};
+    if (phase == Done)
+        return;
+    if (phaseClock.elapsed() > phaseTimeoutMs) {
+        check(false, QString("%1阶段超时").arg(phaseNames[phase]));
+        finish();
+        return;
+    }
+
+    QVariantMap stats = player->networkStats();
+    switch (phase) {
+    case Downloading: {
+        //服务器在dropOffset断开后，下一次请求必须从这个偏移续传
+        bool resumed = false;
+        for (const TestHttpServer::Request &request : server->requests()) {
+            if (request.path == "/clip.mkv" && request.offset == dropOffset)
+                resumed = true;
+        }
+        if (resumed && player->state() == VideoPlayer::Playing && player->position() >= 2000) {
+            check(true, "断线后从断开的偏移续传");
+            server->setStalled(true);
+            enterPhase(Stalling);
+        }
+        break;
+    }
+    case Stalling:
+        if (player->state() == VideoPlayer::Buffering) {
+            check(true, "缓冲低于低水位进入Buffering");
+            server->setStalled(false);
+            enterPhase(Resuming);
+        }
+        break;
+    case Resuming:
+        //仍然限速，缓冲要靠下载慢慢涨回高水位；回到Playing时的缓冲量证明确实等到了高水位
+        if (player->state() == VideoPlayer::Playing) {
+            qint64 bufferedMs = stats.value("bufferedMs").toLongLong();
+            check(bufferedMs >= highWatermark && !stats.value("finished").toBool(),
+                  QString("缓冲恢复到高水位后继续播放（%1 ms）").arg(bufferedMs));
+            server->setRate(0);
+            enterPhase(Completing);
+        }
+        break;
+    case Completing:
+        if (player->state() == VideoPlayer::Playing && stats.value("finished").toBool()) {
+            requestsBeforeSeek = server->requestCount("/clip.mkv");
+            player->setPosi(1000);
+            enterPhase(SeekingBack);
+        }
+        break;
+    case SeekingBack:
+        if (player->state() == VideoPlayer::Playing && player->position() >= 2000) {
+            check(server->requestCount("/clip.mkv") == requestsBeforeSeek, "seek回已缓存的范围不重新请求");
+            check(stats.value("spilledBytes").toLongLong() > 0, "超过内存上限的数据写入临时文件");
+            check(stats.value("reconnects").toInt() >= 1, "重连计入统计");
+            startHls();
+        }
+        break;
+    case Hls:
+        maxPrefetched = qMax(maxPrefetched, stats.value("prefetchedSegments").toInt());
+        if (player->state() == VideoPlayer::Playing && player->position() >= 4 * hlsSegmentSeconds * 1000) {
+            checkHls();
+            finish();
+        }
+        break;
+    case Done:
+        break;
+    }
+}
+
+void NetTestRunner::startHls()
+{
+    player->stop();
+    if (!player->loadFile(server->url("/hls/index.m3u8"))) {
+        check(false, "打开HLS播放列表");
+        finish();
+        return;
+    }
+    player->play();
+    enterPhase(Hls);
+}
+
+//播放过的分片都只请求过一次（预取的分片被直接使用），并且当前分片之后的分片已经在下载
+void NetTestRunner::checkHls()
+{
+    QRegularExpression segmentPattern("^/hls/index(\\d+)\\.ts$");
+    QHash<int, int> counts;
+    int highest = -1;
+    for (const TestHttpServer::Request &request : server->requests()) {
+        QRegularExpressionMatch match = segmentPattern.match(request.path);
+        if (!match.hasMatch())
+            continue;
+        int index = match.captured(1).toInt();
+        ++counts[index];
+        highest = qMax(highest, index);
+    }
+
+    int current = int(player->position() / (hlsSegmentSeconds * 1000));
+    bool once = true;
+    for (int i = 0; i <= current; ++i) {
+        if (counts.value(i) != 1)
+            once = false;
+    }
+    check(once, "HLS分片命中预取，每个只请求一次");
+    check(highest > current, "HLS预取当前分片之后的分片");
+    check(maxPrefetched > 0, "预取完成的分片计入统计");
+}
+
+void NetTestRunner::finish()
+{
+    phase = Done;
+    timer->stop();
+    if (player)
+        player->stop();
+    bool ok = failures.isEmpty();
+    printf("net: %s  通过 %d 项  失败 %lld 项\n", ok ? "通过" : "失败", passed, qint64(failures.size()));
+    fflush(stdout);
+    emit finished(ok ? 0 : 1);
+}
@@ -0,0 +1,130 @@
+#ifndef NETTESTRUNNER_H
+#define NETTESTRUNNER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QString>
+#include <QDebug>
+
+class VideoPlayer;
+
+//测试用的HTTP服务器：提供目录下的文件，支持Range续传；可以限速、暂停发送，并在指定偏移处断开一次连接
+class TestHttpServer : public QObject
+{
+    Q_OBJECT
+public:
+    struct Request{
+        QString path;
+        qint64 offset=0;
+    };
+
+    explicit TestHttpServer(const QString &root, QObject *parent = nullptr);
+
+    bool listen();
+    QString url(const QString &path) const;
+
+    void setRate(qint64 bytesPerSecond);       //0表示不限速
+    void setStalled(bool stalled);
+    //path的响应发送到文件偏移offset时断开连接，只断开一次
+    void dropOnce(const QString &path, qint64 offset);
+    bool dropped() const{
+        return dropDone;
+    }
+
+    const QList<Request> &requests() const{
+        return m_requests;
+    }
+    int requestCount(const QString &path) const;
+
+private slots:
+    void onNewConnection();
+    void pump();
+
+private:
+    struct Connection{
+        QByteArray header;
+        QString path;
+        QIODevice *file=nullptr;    //以socket为父对象
+        qint64 pos=0;
+        qint64 end=0;
+        bool sending=false;
+    };
+
+    void handleRequest(QTcpSocket *socket, Connection &c);
+    void finishResponse(QTcpSocket *socket, Connection &c);
+
+    QString root;
+    QTcpServer server;
+    QTimer pumpTimer;
+    QElapsedTimer pumpClock;
+    QHash<QTcpSocket*, Connection> connections;
+    QList<Request> m_requests;
+    qint64 rate=0;
+    bool stalled=false;
+    QString dropPath;
+    qint64 dropOffset=-1;
+    bool dropDone=false;
+};
+
+//网络输入测试：本地HTTP服务器提供合成片段和HLS播放列表，依次检查
+//断线续传、溢出到临时文件、水位暂停与恢复、seek回已缓存范围不重新请求、HLS分片预取命中。
+//全部通过返回0，任一项失败返回1，无法准备环境返回2
+class NetTestRunner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NetTestRunner(QObject *parent = nullptr);
+    ~NetTestRunner();
+
+    void start();
+
+    static const int clipSeconds = 30;
+    static const int hlsSegmentSeconds = 2;
+    static const qint64 dropOffset = 2 * 1024 * 1024;
+    static const int phaseTimeoutMs = 30000;
+    static const int lowWatermark = 1500;
+    static const int highWatermark = 3000;
+
+signals:
+    void finished(int exitCode);
+
+private slots:
+    void tick();
+
+private:
+    enum Phase{
+        Downloading,        //限速下载，等待断线续传后开始播放
+        Stalling,           //服务器暂停发送，等待进入Buffering
+        Resuming,           //按原来的限速恢复发送，等待缓冲回到高水位后继续播放
+        Completing,         //取消限速，等待下载完
+        SeekingBack,        //seek回已缓存的位置，不应产生新的请求
+        Hls,                //播放HLS，检查分片预取
+        Done
+    };
+
+    void enterPhase(Phase next);
+    void check(bool ok, const QString &what);
+    void startHls();
+    void checkHls();
+    void finish();
+
+    QTemporaryDir tempDir;
+    TestHttpServer *server=nullptr;
+    VideoPlayer *player=nullptr;
+    QTimer *timer=nullptr;
+    QElapsedTimer phaseClock;
+    Phase phase=Downloading;
+    QStringList failures;
+    int passed=0;
+    int requestsBeforeSeek=0;
+    int maxPrefetched=0;
+};
+
+#endif // NETTESTRUNNER_H
@@ -0,0 +1,579 @@
+#include "networkcache.h"
+#include <QUrl>
+#include <cstring>
+#include <vector>
+
+//读位置超出已下载范围这么多时，直接从新位置重新请求，而不是顺序下载过去
+static const qint64 seekGap = 1024 * 1024;
+
+CachedStream::CachedStream(const QString &url, NetworkCache *o, qint64 limit)
+    : QThread(nullptr),
+    m_url(url),
+    owner(o),
+    readAheadLimit(limit){
+    interruptCb.callback = &CachedStream::interruptCallback;
+    interruptCb.opaque = this;
+}
+
+CachedStream::~CachedStream() {
+    abort();
+    wait();
+}
+
+int CachedStream::interruptCallback(void *opaque)
+{
+    return static_cast<CachedStream*>(opaque)->aborted ? 1 : 0;
+}
+
+void CachedStream::abort()
+{
+    aborted=true;
+    QMutexLocker locker(&mutex);
+    dataReady.wakeAll();
+    spaceReady.wakeAll();
+}
+
+//打开上游连接，offset>0时通过http的offset选项断点续传
+bool CachedStream::openSource(qint64 offset)
+{
+    AVDictionary *opts=nullptr;
+    av_dict_set(&opts, "rw_timeout", "10000000", 0);
+    if (offset > 0)
+        av_dict_set_int(&opts, "offset", offset, 0);
+    int ret = avio_open2(&source, m_url.toUtf8().constData(), AVIO_FLAG_READ, &interruptCb, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        qWarning() << "网络：无法打开" << m_url;
+        return false;
+    }
+
+    int64_t size = avio_size(source);
+    QMutexLocker locker(&mutex);
+    if (totalSize < 0 && size > 0)
+        totalSize = size;
+    return true;
+}
+
+//断线重连，退避间隔从250ms开始加倍，最长8秒
+bool CachedStream::reconnect(qint64 offset)
+{
+    for (int attempt = 0; attempt < maxRetries && !aborted; ++attempt) {
+        avio_closep(&source);
+        int backoff = qMin(250 << attempt, 8000);
+        for (int waited = 0; waited < backoff && !aborted; waited += 50)
+            msleep(50);
+        if (aborted)
+            break;
+        if (openSource(offset)) {
+            owner->addReconnect();
+            qDebug() << "网络：重连成功" << m_url << "offset" << offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+//丢弃已缓存的数据，从offset重新开始一段连续范围
+void CachedStream::resetRange(qint64 offset)
+{
+    memory.clear();
+    if (spill.isOpen())
+        spill.resize(0);
+    baseOffset = memStart = writePos = offset;
+    eof = false;
+    failed = false;
+    ++generation;
+}
+
+//追加下载的数据，内存超出上限时把较早的一半写入临时文件
+void CachedStream::append(const uint8_t *data, int size)
+{
+    memory.append(reinterpret_cast<const char*>(data), size);
+    writePos += size;
+    if (memory.size() <= memoryLimit)
+        return;
+
+    int k = memory.size() - memoryLimit / 2;
+    if (!spill.isOpen() && !spill.open()) {
+        //无法写临时文件时只保留内存中的部分
+        memory.remove(0, k);
+        memStart += k;
+        baseOffset = memStart;
+        return;
+    }
+    spill.seek(memStart - baseOffset);
+    spill.write(memory.constData(), k);
+    memory.remove(0, k);
+    memStart += k;
+    owner->addSpilled(k);
+}
+
+bool CachedStream::outOfRange(qint64 pos) const
+{
+    return pos < baseOffset || pos > writePos + seekGap;
+}
+
+//下载线程：保持读位置之前最多readAheadLimit字节的预读
+void CachedStream::run()
+{
+    std::vector<uint8_t> buf(65536);
+
+    if (!openSource(0) && !reconnect(0)) {
+        QMutexLocker locker(&mutex);
+        failed = true;
+        dataReady.wakeAll();
+    }
+
+    while (!aborted) {
+        qint64 pos = 0;
+        int gen = 0;
+        bool reposition = false;
+        {
+            QMutexLocker locker(&mutex);
+            while (!aborted && seekRequest < 0 &&
+                   (eof || failed || writePos - readPos >= readAheadLimit))
+                spaceReady.wait(&mutex);
+            if (aborted)
+                break;
+            if (seekRequest >= 0) {
+                pos = seekRequest;
+                seekRequest = -1;
+                resetRange(pos);
+                reposition = true;
+            } else {
+                pos = writePos;
+            }
+            gen = generation;
+        }
+
+        if (reposition || !source) {
+            bool ok = source && avio_seek(source, pos, SEEK_SET) >= 0;
+            if (!ok)
+                ok = reconnect(pos);
+            if (!ok) {
+                QMutexLocker locker(&mutex);
+                if (gen == generation) {
+                    failed = true;
+                    dataReady.wakeAll();
+                }
+            }
+            continue;
+        }
+
+        int n = avio_read(source, buf.data(), int(buf.size()));
+        if (n > 0) {
+            owner->addDownloaded(n);
+            QMutexLocker locker(&mutex);
+            if (gen == generation) {
+                append(buf.data(), n);
+                dataReady.wakeAll();
+            }
+            continue;
+        }
+        if (aborted)
+            break;
+
+        {
+            QMutexLocker locker(&mutex);
+            if (gen != generation)
+                continue;
+            //长度已知且已经下载完整才算结束，否则是连接提前断开
+            if (n == AVERROR_EOF && (totalSize < 0 || writePos >= totalSize)) {
+                eof = true;
+                if (totalSize < 0)
+                    totalSize = writePos;
+                dataReady.wakeAll();
+                continue;
+            }
+        }
+
+        qWarning() << "网络：读取中断，尝试续传" << m_url << "offset" << pos;
+        if (!reconnect(pos)) {
+            QMutexLocker locker(&mutex);
+            if (gen == generation) {
+                failed = true;
+                dataReady.wakeAll();
+            }
+        }
+    }
+
+    avio_closep(&source);
+}
+
+//由DemuxThread读取，数据未到时阻塞等待；界面线程不直接读网络输入
+int CachedStream::read(uint8_t *buf, int size)
+{
+    QMutexLocker locker(&mutex);
+    while (true) {
+        if (aborted)
+            return AVERROR_EXIT;
+        if (readPos >= baseOffset && readPos < writePos)
+            break;
+        if (seekRequest < 0) {
+            if (outOfRange(readPos)) {
+                seekRequest = readPos;
+                spaceReady.wakeAll();
+            } else if (eof) {
+                return AVERROR_EOF;
+            } else if (failed) {
+                return AVERROR(EIO);
+            }
+        }
+        dataReady.wait(&mutex, 100);
+    }
+
+    int n = int(qMin<qint64>(size, writePos - readPos));
+    if (readPos < memStart) {
+        n = int(qMin<qint64>(n, memStart - readPos));
+        spill.seek(readPos - baseOffset);
+        n = int(spill.read(reinterpret_cast<char*>(buf), n));
+        if (n <= 0)
+            return AVERROR(EIO);
+    } else {
+        memcpy(buf, memory.constData() + (readPos - memStart), n);
+    }
+    readPos += n;
+    spaceReady.wakeAll();
+    return n;
+}
+
+int64_t CachedStream::seek(int64_t offset, int whence)
+{
+    QMutexLocker locker(&mutex);
+    if (whence & AVSEEK_SIZE)
+        return totalSize >= 0 ? totalSize : AVERROR(ENOSYS);
+
+    qint64 pos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = readPos + offset; break;
+    case SEEK_END:
+        if (totalSize < 0)
+            return AVERROR(ENOSYS);
+        pos = totalSize + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+    readPos = pos;
+    if (outOfRange(pos)) {
+        seekRequest = pos;
+        spaceReady.wakeAll();
+    }
+    return pos;
+}
+
+AVIOContext *CachedStream::createIOContext()
+{
+    const int bufferSize = 32768;
+    uint8_t *buffer = static_cast<uint8_t*>(av_malloc(bufferSize));
+    if (!buffer)
+        return nullptr;
+    AVIOContext *pb = avio_alloc_context(buffer, bufferSize, 0, this,
+        [](void *opaque, uint8_t *buf, int size) {
+            return static_cast<CachedStream*>(opaque)->read(buf, size);
+        },
+        nullptr,
+        [](void *opaque, int64_t offset, int whence) {
+            return static_cast<CachedStream*>(opaque)->seek(offset, whence);
+        });
+    if (!pb) {
+        av_free(buffer);
+        return nullptr;
+    }
+    pb->seekable = AVIO_SEEKABLE_NORMAL;
+    return pb;
+}
+
+qint64 CachedStream::bufferedBytes()
+{
+    QMutexLocker locker(&mutex);
+    if (readPos < baseOffset || readPos > writePos)
+        return 0;
+    return writePos - readPos;
+}
+
+bool CachedStream::finished()
+{
+    QMutexLocker locker(&mutex);
+    return eof;
+}
+
+//播放列表一类的小文件下载完成后返回全部内容
+QByteArray CachedStream::smallContent(int maxSize)
+{
+    QMutexLocker locker(&mutex);
+    if (!eof || baseOffset != 0 || memStart != 0 || writePos > maxSize)
+        return QByteArray();
+    return memory;
+}
+
+NetworkCache::NetworkCache(QObject *parent)
+    : QObject(parent){
+
+}
+
+NetworkCache::~NetworkCache() {
+    close();
+}
+
+bool NetworkCache::isNetworkUrl(const QString &url)
+{
+    QString scheme = QUrl(url).scheme().toLower();
+    return scheme == QLatin1String("http") || scheme == QLatin1String("https");
+}
+
+//给formatCtx装上带缓存的AVIOContext，并接管io_open以缓存HLS的播放列表和分片
+int NetworkCache::attach(AVFormatContext *ctx, const QString &url)
+{
+    close();
+    aborting = false;
+    formatCtx = ctx;
+    mainStream = new CachedStream(url, this, mainReadAhead);
+    mainStream->start();
+    mainIO = mainStream->createIOContext();
+    if (!mainIO)
+        return AVERROR(ENOMEM);
+
+    formatCtx->pb = mainIO;
+    formatCtx->opaque = this;
+    formatCtx->io_open = &NetworkCache::ioOpen;
+    formatCtx->io_close = &NetworkCache::ioClose;
+    statsClock.start();
+    return 0;
+}
+
+//让正在阻塞的读取立即返回AVERROR_EXIT，之后不再打开新的连接；用于结束解复用线程
+void NetworkCache::abort()
+{
+    aborting = true;
+    if (mainStream)
+        mainStream->abort();
+    QMutexLocker locker(&mutex);
+    for (CachedStream *stream : activeStreams)
+        stream->abort();
+    for (CachedStream *stream : prefetched)
+        stream->abort();
+}
+
+//必须在avformat_close_input()之后调用，自定义IO的主AVIOContext由这里释放
+void NetworkCache::close()
+{
+    QList<CachedStream*> streams;
+    {
+        QMutexLocker locker(&mutex);
+        streams = prefetched.values();
+        prefetched.clear();
+        streams += activeStreams;
+        activeStreams.clear();
+        ioStreams.clear();
+        segmentOrder.clear();
+    }
+    qDeleteAll(streams);
+
+    if (mainIO) {
+        av_freep(&mainIO->buffer);
+        avio_context_free(&mainIO);
+    }
+    delete mainStream;
+    mainStream = nullptr;
+    formatCtx = nullptr;
+    lastDownloaded = downloaded;
+    bandwidth = 0;
+}
+
+int NetworkCache::ioOpen(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options)
+{
+    NetworkCache *cache = static_cast<NetworkCache*>(s->opaque);
+    if ((flags & AVIO_FLAG_WRITE) || !isNetworkUrl(QString::fromUtf8(url)))
+        return avio_open2(pb, url, flags, &s->interrupt_callback, options);
+
+    if (cache->aborting)
+        return AVERROR_EXIT;
+
+    CachedStream *stream = cache->acquireStream(QString::fromUtf8(url));
+    *pb = stream->createIOContext();
+    if (!*pb) {
+        cache->releaseStream(stream);
+        return AVERROR(ENOMEM);
+    }
+    QMutexLocker locker(&cache->mutex);
+    cache->ioStreams.insert(*pb, stream);
+    return 0;
+}
+
+void NetworkCache::ioClose(AVFormatContext *s, AVIOContext *pb)
+{
+    NetworkCache *cache = static_cast<NetworkCache*>(s->opaque);
+    CachedStream *stream = nullptr;
+    {
+        QMutexLocker locker(&cache->mutex);
+        stream = cache->ioStreams.take(pb);
+    }
+    if (!stream) {
+        avio_close(pb);
+        return;
+    }
+    av_freep(&pb->buffer);
+    avio_context_free(&pb);
+    cache->releaseStream(stream);
+}
+
+//优先使用已经预取的分片
+CachedStream *NetworkCache::acquireStream(const QString &url)
+{
+    if (mainStream && !mainStream->playlistParsed)
+        parsePlaylist(mainStream);
+
+    CachedStream *stream = nullptr;
+    {
+        QMutexLocker locker(&mutex);
+        stream = prefetched.take(url);
+    }
+    if (!stream) {
+        stream = new CachedStream(url, this, mainReadAhead);
+        stream->start();
+    }
+    {
+        QMutexLocker locker(&mutex);
+        activeStreams.append(stream);
+    }
+    prefetchAfter(url);
+    return stream;
+}
+
+void NetworkCache::releaseStream(CachedStream *stream)
+{
+    if (!stream->playlistParsed)
+        parsePlaylist(stream);
+    {
+        QMutexLocker locker(&mutex);
+        activeStreams.removeOne(stream);
+    }
+    delete stream;
+}
+
+//从m3u8中取出分片地址，记录播放顺序供预取使用
+void NetworkCache::parsePlaylist(CachedStream *stream)
+{
+    QByteArray content = stream->smallContent(1024 * 1024);
+    if (content.isEmpty())
+        return;
+    stream->playlistParsed = true;
+    if (!content.startsWith("#EXTM3U"))
+        return;
+
+    QUrl base(stream->url());
+    QStringList segments;
+    for (const QByteArray &raw : content.split('\n')) {
+        QByteArray line = raw.trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        QUrl resolved = base.resolved(QUrl(QString::fromUtf8(line)));
+        if (resolved.path().endsWith(QLatin1String(".m3u8")))
+            continue;   //主播放列表中的子列表不预取
+        segments << resolved.toString();
+    }
+
+    QMutexLocker locker(&mutex);
+    for (const QString &segment : segments) {
+        if (!segmentOrder.contains(segment))
+            segmentOrder << segment;
+    }
+    //直播列表会不断增长，只保留最近的部分
+    while (segmentOrder.size() > 1000)
+        segmentOrder.removeFirst();
+}
+
+//打开某个分片时，预取其后的几个分片，并丢弃已经播放过的预取
+void NetworkCache::prefetchAfter(const QString &url)
+{
+    QList<CachedStream*> stale;
+    {
+        QMutexLocker locker(&mutex);
+        int index = segmentOrder.indexOf(url);
+        if (index < 0)
+            return;
+
+        for (auto it = prefetched.begin(); it != prefetched.end();) {
+            if (segmentOrder.indexOf(it.key()) <= index) {
+                stale << it.value();
+                it = prefetched.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        for (int i = index + 1; i <= index + prefetchSegments && i < segmentOrder.size(); ++i) {
+            const QString &next = segmentOrder.at(i);
+            if (prefetched.contains(next))
+                continue;
+            CachedStream *stream = new CachedStream(next, this, mainReadAhead);
+            stream->start(QThread::LowPriority);
+            prefetched.insert(next, stream);
+        }
+    }
+    qDeleteAll(stale);
+}
+
+//更新带宽估计（指数平滑），统计缓冲量；bitRate未知时按2Mbit/s估算缓冲时长
+NetworkCache::Stats NetworkCache::updateStats(qint64 bitRate)
+{
+    Stats stats;
+    qint64 elapsed = statsClock.isValid() ? statsClock.restart() : 0;
+    qint64 total = downloaded;
+    if (elapsed > 0) {
+        qint64 current = (total - lastDownloaded) * 8 * 1000 / elapsed;
+        bandwidth = bandwidth > 0 ? (bandwidth * 7 + current) / 8 : current;
+    }
+    lastDownloaded = total;
+
+    stats.bandwidth = bandwidth;
+    stats.spilledBytes = spilled;
+    stats.reconnects = reconnects;
+
+    if (mainStream)
+        stats.bufferedBytes += mainStream->bufferedBytes();
+
+    QMutexLocker locker(&mutex);
+    for (CachedStream *stream : activeStreams)
+        stats.bufferedBytes += stream->bufferedBytes();
+    for (CachedStream *stream : prefetched) {
+        stats.bufferedBytes += stream->bufferedBytes();
+        if (stream->finished())
+            ++stats.prefetchedSegments;
+    }
+
+    if (segmentOrder.isEmpty()) {
+        stats.finished = mainStream && mainStream->finished();
+    } else {
+        const QString &last = segmentOrder.last();
+        for (CachedStream *stream : activeStreams + prefetched.values()) {
+            if (stream->url() == last && stream->finished())
+                stats.finished = true;
+        }
+    }
+
+    if (bitRate <= 0)
+        bitRate = 2000000;
+    stats.bufferedMs = stats.bufferedBytes * 8 * 1000 / bitRate;
+    return stats;
+}
+
+void NetworkCache::addDownloaded(qint64 bytes)
+{
+    downloaded += bytes;
+}
+
+void NetworkCache::addSpilled(qint64 bytes)
+{
+    spilled += bytes;
+}
+
+void NetworkCache::addReconnect()
+{
+    ++reconnects;
+}
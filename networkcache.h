@@ -0,0 +1,150 @@
+#ifndef NETWORKCACHE_H
+#define NETWORKCACHE_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QTemporaryFile>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QList>
+#include <QDebug>
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libavutil/dict.h>
+}
+
+class NetworkCache;
+
+//单个URL的预读缓存：后台线程下载，最近的数据在内存中，超过内存上限的部分写入临时文件
+class CachedStream : public QThread
+{
+    Q_OBJECT
+public:
+    CachedStream(const QString &url, NetworkCache *owner, qint64 readAheadLimit);
+    ~CachedStream();
+
+    void run() override;
+
+    //以下由解复用线程调用
+    int read(uint8_t *buf, int size);
+    int64_t seek(int64_t offset, int whence);
+    AVIOContext *createIOContext();
+
+    void abort();
+    QString url() const{
+        return m_url;
+    }
+    qint64 bufferedBytes();
+    bool finished();
+    QByteArray smallContent(int maxSize);
+
+    bool playlistParsed=false;
+
+    static const int memoryLimit = 4 * 1024 * 1024;
+    static const int maxRetries = 6;
+
+private:
+    bool openSource(qint64 offset);
+    bool reconnect(qint64 offset);
+    void resetRange(qint64 offset);
+    void append(const uint8_t *data, int size);
+    bool outOfRange(qint64 pos) const;
+
+    static int interruptCallback(void *opaque);
+
+    QString m_url;
+    NetworkCache *owner=nullptr;
+    AVIOContext *source=nullptr;
+    AVIOInterruptCB interruptCb;
+
+    QMutex mutex;
+    QWaitCondition dataReady;
+    QWaitCondition spaceReady;
+
+    QByteArray memory;          //保存[memStart, writePos)
+    QTemporaryFile spill;       //保存[baseOffset, memStart)
+    qint64 baseOffset=0;
+    qint64 memStart=0;
+    qint64 writePos=0;
+    qint64 readPos=0;
+    qint64 totalSize=-1;
+    qint64 seekRequest=-1;
+    qint64 readAheadLimit=0;
+    int generation=0;
+    bool eof=false;
+    bool failed=false;
+    std::atomic<bool> aborted{false};
+};
+
+//网络输入：为AVFormatContext提供带缓存的AVIOContext，HLS分片按播放列表顺序预取
+class NetworkCache : public QObject
+{
+    Q_OBJECT
+public:
+    struct Stats{
+        qint64 bandwidth=0;       //下载速率，bit/s
+        qint64 bufferedBytes=0;
+        qint64 bufferedMs=0;
+        qint64 spilledBytes=0;
+        int reconnects=0;
+        int prefetchedSegments=0;
+        bool finished=false;
+    };
+
+    explicit NetworkCache(QObject *parent = nullptr);
+    ~NetworkCache();
+
+    static bool isNetworkUrl(const QString &url);
+
+    int attach(AVFormatContext *formatCtx, const QString &url);
+    void abort();
+    void close();
+
+    //按固定间隔调用，更新带宽估计并返回当前统计
+    Stats updateStats(qint64 bitRate);
+
+    //以下由下载线程调用
+    void addDownloaded(qint64 bytes);
+    void addSpilled(qint64 bytes);
+    void addReconnect();
+
+    static const qint64 mainReadAhead = 64LL * 1024 * 1024;
+    static const int prefetchSegments = 3;
+
+private:
+    static int ioOpen(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options);
+    static void ioClose(AVFormatContext *s, AVIOContext *pb);
+
+    CachedStream *acquireStream(const QString &url);
+    void releaseStream(CachedStream *stream);
+    void parsePlaylist(CachedStream *stream);
+    void prefetchAfter(const QString &url);
+
+    AVFormatContext *formatCtx=nullptr;
+    CachedStream *mainStream=nullptr;
+    AVIOContext *mainIO=nullptr;
+    QMutex mutex;
+    QList<CachedStream*> activeStreams;
+    QHash<AVIOContext*, CachedStream*> ioStreams;
+    QHash<QString, CachedStream*> prefetched;
+    QStringList segmentOrder;
+
+    std::atomic<bool> aborting{false};
+    std::atomic<qint64> downloaded{0};
+    std::atomic<qint64> spilled{0};
+    std::atomic<int> reconnects{0};
+    qint64 lastDownloaded=0;
+    qint64 bandwidth=0;
+    QElapsedTimer statsClock;
+};
+
+#endif // NETWORKCACHE_H
@@ -0,0 +1,126 @@
+#ifndef PEAKKERNELS_H
+#define PEAKKERNELS_H
+
+#include <cstddef>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+//波形概览用的最小值/最大值/平方和累加，按编译目标选择AVX2、SSE2、NEON或标量实现
+namespace PeakKernels {
+
+struct PeakAccum{
+    float min=0.0f;
+    float max=0.0f;
+    double sumSq=0.0;
+    long long count=0;
+};
+
+//标量实现，也用于处理向量化后剩余的尾部样本
+inline void accumulateScalar(const float *samples, size_t n, PeakAccum &acc)
+{
+    float mn = acc.count ? acc.min : samples[0];
+    float mx = acc.count ? acc.max : samples[0];
+    double sq = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        float v = samples[i];
+        mn = v < mn ? v : mn;
+        mx = v > mx ? v : mx;
+        sq += double(v) * v;
+    }
+    acc.min = mn;
+    acc.max = mx;
+    acc.sumSq += sq;
+    acc.count += (long long)n;
+}
+
+//对n个float样本更新acc
+inline void accumulate(const float *samples, size_t n, PeakAccum &acc)
+{
+    if (n == 0)
+        return;
+    size_t i = 0;
+    float mn = acc.count ? acc.min : samples[0];
+    float mx = acc.count ? acc.max : samples[0];
+    double sq = 0.0;
+
+#if defined(__AVX2__)
+    if (n >= 8) {
+        __m256 vmin = _mm256_set1_ps(mn);
+        __m256 vmax = _mm256_set1_ps(mx);
+        __m256 vsq = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _mm256_loadu_ps(samples + i);
+            vmin = _mm256_min_ps(vmin, v);
+            vmax = _mm256_max_ps(vmax, v);
+            vsq = _mm256_add_ps(vsq, _mm256_mul_ps(v, v));
+        }
+        alignas(32) float lmin[8], lmax[8], lsq[8];
+        _mm256_store_ps(lmin, vmin);
+        _mm256_store_ps(lmax, vmax);
+        _mm256_store_ps(lsq, vsq);
+        for (int k = 0; k < 8; ++k) {
+            mn = lmin[k] < mn ? lmin[k] : mn;
+            mx = lmax[k] > mx ? lmax[k] : mx;
+            sq += lsq[k];
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    if (n >= 4) {
+        __m128 vmin = _mm_set1_ps(mn);
+        __m128 vmax = _mm_set1_ps(mx);
+        __m128 vsq = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(samples + i);
+            vmin = _mm_min_ps(vmin, v);
+            vmax = _mm_max_ps(vmax, v);
+            vsq = _mm_add_ps(vsq, _mm_mul_ps(v, v));
+        }
+        alignas(16) float lmin[4], lmax[4], lsq[4];
+        _mm_store_ps(lmin, vmin);
+        _mm_store_ps(lmax, vmax);
+        _mm_store_ps(lsq, vsq);
+        for (int k = 0; k < 4; ++k) {
+            mn = lmin[k] < mn ? lmin[k] : mn;
+            mx = lmax[k] > mx ? lmax[k] : mx;
+            sq += lsq[k];
+        }
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    if (n >= 4) {
+        float32x4_t vmin = vdupq_n_f32(mn);
+        float32x4_t vmax = vdupq_n_f32(mx);
+        float32x4_t vsq = vdupq_n_f32(0.0f);
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(samples + i);
+            vmin = vminq_f32(vmin, v);
+            vmax = vmaxq_f32(vmax, v);
+            vsq = vmlaq_f32(vsq, v, v);
+        }
+        float lmin[4], lmax[4], lsq[4];
+        vst1q_f32(lmin, vmin);
+        vst1q_f32(lmax, vmax);
+        vst1q_f32(lsq, vsq);
+        for (int k = 0; k < 4; ++k) {
+            mn = lmin[k] < mn ? lmin[k] : mn;
+            mx = lmax[k] > mx ? lmax[k] : mx;
+            sq += lsq[k];
+        }
+    }
+#endif
+
+    acc.min = mn;
+    acc.max = mx;
+    acc.sumSq += sq;
+    acc.count += (long long)i;
+    if (i < n)
+        accumulateScalar(samples + i, n - i, acc);
+}
+
+} // namespace PeakKernels
+
+#endif // PEAKKERNELS_H
@@ -0,0 +1,393 @@
+#include "probecache.h"
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QFile>
+#include <QDir>
+#include <QUrl>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+static const quint32 probeMagic=0x50524231;     //"PRB1"
+static const quint32 probeVersion=2;      //1版本的关键帧按pts记录，不再使用
+
+//qml传入的可能是file:///形式的url，转换为本地路径
+static QString localPath(const QString &fileName)
+{
+    QUrl url(fileName);
+    return url.isLocalFile()?url.toLocalFile():fileName;
+}
+
+static QString cacheDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)+"/probe";
+}
+
+static QDataStream &operator<<(QDataStream &out, const AVRational &r)
+{
+    return out<<qint32(r.num)<<qint32(r.den);
+}
+
+static QDataStream &operator>>(QDataStream &in, AVRational &r)
+{
+    qint32 num=0,den=1;
+    in>>num>>den;
+    r=AVRational{num,den};
+    return in;
+}
+
+static QDataStream &operator<<(QDataStream &out, const ProbeStream &s)
+{
+    out<<s.codecType<<s.codecId<<s.codecTag<<s.format<<s.bitRate
+       <<s.bitsPerCodedSample<<s.bitsPerRawSample<<s.profile<<s.level
+       <<s.width<<s.height<<s.sampleAspectRatio<<s.fieldOrder
+       <<s.colorRange<<s.colorPrimaries<<s.colorTrc<<s.colorSpace<<s.chromaLocation<<s.videoDelay
+       <<s.channelLayout<<s.channels<<s.sampleRate<<s.blockAlign<<s.frameSize
+       <<s.initialPadding<<s.trailingPadding<<s.seekPreroll<<s.extradata
+       <<s.timeBase<<s.avgFrameRate<<s.rFrameRate<<s.startTime<<s.duration<<s.nbFrames;
+    return out;
+}
+
+static QDataStream &operator>>(QDataStream &in, ProbeStream &s)
+{
+    in>>s.codecType>>s.codecId>>s.codecTag>>s.format>>s.bitRate
+      >>s.bitsPerCodedSample>>s.bitsPerRawSample>>s.profile>>s.level
+      >>s.width>>s.height>>s.sampleAspectRatio>>s.fieldOrder
+      >>s.colorRange>>s.colorPrimaries>>s.colorTrc>>s.colorSpace>>s.chromaLocation>>s.videoDelay
+      >>s.channelLayout>>s.channels>>s.sampleRate>>s.blockAlign>>s.frameSize
+      >>s.initialPadding>>s.trailingPadding>>s.seekPreroll>>s.extradata
+      >>s.timeBase>>s.avgFrameRate>>s.rFrameRate>>s.startTime>>s.duration>>s.nbFrames;
+    return in;
+}
+
+//缓存文件放在系统缓存目录下，以文件路径的哈希命名
+QString ProbeCache::cachePath(const QString &fileName)
+{
+    QString path=QFileInfo(localPath(fileName)).absoluteFilePath();
+    QByteArray key=QCryptographicHash::hash(path.toUtf8(),QCryptographicHash::Sha1).toHex();
+    return cacheDir()+"/"+QString::fromLatin1(key)+".probe";
+}
+
+bool ProbeCache::load(const QString &fileName, ProbeEntry &entry)
+{
+    QString path=cachePath(fileName);
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)){
+        return false;
+    }
+
+    QFileInfo info(localPath(fileName));
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic=0,version=0,lavfVersion=0;
+    qint64 fileSize=0,mtime=0;
+    in>>magic>>version>>lavfVersion>>fileSize>>mtime;
+    //文件大小、修改时间或FFmpeg版本变化后缓存失效
+    if(magic!=probeMagic||version!=probeVersion||lavfVersion!=avformat_version()
+        ||fileSize!=info.size()||mtime!=info.lastModified().toMSecsSinceEpoch()){
+        file.close();
+        QFile::remove(path);
+        return false;
+    }
+
+    quint32 streamCount=0,keyframeCount=0;
+    in>>entry.formatName>>entry.duration>>entry.startTime>>entry.bitRate
+      >>entry.videoStream>>entry.audioStream>>streamCount;
+    if(streamCount>1024){
+        file.close();
+        QFile::remove(path);
+        return false;
+    }
+    entry.streams.resize(streamCount);
+    for(ProbeStream &stream:entry.streams){
+        in>>stream;
+    }
+    in>>keyframeCount;
+    if(keyframeCount>quint32(maxKeyframes)){
+        keyframeCount=0;
+    }
+    entry.keyframes.resize(keyframeCount);
+    for(ProbeIndexEntry &keyframe:entry.keyframes){
+        in>>keyframe.pos>>keyframe.timestamp>>keyframe.size>>keyframe.distance;
+    }
+
+    if(in.status()!=QDataStream::Ok){
+        qWarning()<<"探测缓存损坏，已删除"<<path;
+        file.close();
+        QFile::remove(path);
+        return false;
+    }
+
+    //更新修改时间，作为按最近使用清理的依据
+    file.close();
+    if(file.open(QIODevice::ReadWrite)){
+        file.setFileTime(QDateTime::currentDateTime(),QFileDevice::FileModificationTime);
+    }
+    return true;
+}
+
+//流上的索引项数，包括非关键帧
+static int indexEntryCount(AVStream *st)
+{
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    return avformat_index_get_entries_count(st);
+#else
+    return st->nb_index_entries;
+#endif
+}
+
+bool ProbeCache::apply(AVFormatContext *formatCtx, const ProbeEntry &entry)
+{
+    if(formatCtx->nb_streams!=unsigned(entry.streams.size())){
+        return false;
+    }
+    //先检查全部流，避免改了一半才发现不一致
+    for(unsigned int i=0;i<formatCtx->nb_streams;++i){
+        const AVStream *st=formatCtx->streams[i];
+        const ProbeStream &cached=entry.streams.at(i);
+        if(st->codecpar->codec_type!=cached.codecType
+            ||(st->codecpar->codec_id!=AV_CODEC_ID_NONE&&st->codecpar->codec_id!=cached.codecId)
+            ||av_cmp_q(st->time_base,cached.timeBase)!=0){
+            return false;
+        }
+    }
+
+    for(unsigned int i=0;i<formatCtx->nb_streams;++i){
+        AVStream *st=formatCtx->streams[i];
+        AVCodecParameters *par=st->codecpar;
+        const ProbeStream &cached=entry.streams.at(i);
+
+        par->codec_id=AVCodecID(cached.codecId);
+        par->codec_tag=cached.codecTag;
+        par->format=cached.format;
+        par->bit_rate=cached.bitRate;
+        par->bits_per_coded_sample=cached.bitsPerCodedSample;
+        par->bits_per_raw_sample=cached.bitsPerRawSample;
+        par->profile=cached.profile;
+        par->level=cached.level;
+        par->width=cached.width;
+        par->height=cached.height;
+        par->sample_aspect_ratio=cached.sampleAspectRatio;
+        par->field_order=AVFieldOrder(cached.fieldOrder);
+        par->color_range=AVColorRange(cached.colorRange);
+        par->color_primaries=AVColorPrimaries(cached.colorPrimaries);
+        par->color_trc=AVColorTransferCharacteristic(cached.colorTrc);
+        par->color_space=AVColorSpace(cached.colorSpace);
+        par->chroma_location=AVChromaLocation(cached.chromaLocation);
+        par->video_delay=cached.videoDelay;
+        par->channel_layout=cached.channelLayout;
+        par->channels=cached.channels;
+        par->sample_rate=cached.sampleRate;
+        par->block_align=cached.blockAlign;
+        par->frame_size=cached.frameSize;
+        par->initial_padding=cached.initialPadding;
+        par->trailing_padding=cached.trailingPadding;
+        par->seek_preroll=cached.seekPreroll;
+
+        //探测阶段从码流中解析出的extradata（如AnnexB的SPS/PPS）在打开时还没有
+        if(par->extradata_size==0&&!cached.extradata.isEmpty()){
+            par->extradata=static_cast<uint8_t*>(av_mallocz(cached.extradata.size()+AV_INPUT_BUFFER_PADDING_SIZE));
+            if(par->extradata){
+                memcpy(par->extradata,cached.extradata.constData(),cached.extradata.size());
+                par->extradata_size=cached.extradata.size();
+            }
+        }
+
+        st->avg_frame_rate=cached.avgFrameRate;
+        st->r_frame_rate=cached.rFrameRate;
+        st->start_time=cached.startTime;
+        st->duration=cached.duration;
+        st->nb_frames=cached.nbFrames;
+    }
+
+    formatCtx->duration=entry.duration;
+    formatCtx->start_time=entry.startTime;
+    formatCtx->bit_rate=entry.bitRate;
+
+    if(entry.videoStream>=0&&entry.videoStream<int(formatCtx->nb_streams)
+        &&indexEntryCount(formatCtx->streams[entry.videoStream])==0){
+        AVStream *st=formatCtx->streams[entry.videoStream];
+        for(const ProbeIndexEntry &keyframe:entry.keyframes){
+            av_add_index_entry(st,keyframe.pos,keyframe.timestamp,keyframe.size,keyframe.distance,AVINDEX_KEYFRAME);
+        }
+    }
+    return true;
+}
+
+//解复用器索引中的关键帧，只读取不修改
+static QVector<ProbeIndexEntry> keyframeIndex(AVStream *st)
+{
+    QVector<ProbeIndexEntry> keyframes;
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    int count=avformat_index_get_entries_count(st);
+    for(int i=0;i<count&&keyframes.size()<ProbeCache::maxKeyframes;++i){
+        const AVIndexEntry *e=avformat_index_get_entry(st,i);
+        if(e&&(e->flags&AVINDEX_KEYFRAME)){
+            keyframes.append(ProbeIndexEntry{e->pos,e->timestamp,e->size,e->min_distance});
+        }
+    }
+#else
+    for(int i=0;i<st->nb_index_entries&&keyframes.size()<ProbeCache::maxKeyframes;++i){
+        const AVIndexEntry &e=st->index_entries[i];
+        if(e.flags&AVINDEX_KEYFRAME){
+            keyframes.append(ProbeIndexEntry{e.pos,e.timestamp,e.size,e.min_distance});
+        }
+    }
+#endif
+    return keyframes;
+}
+
+bool ProbeCache::hasOwnIndex(AVFormatContext *formatCtx)
+{
+    for(unsigned int i=0;i<formatCtx->nb_streams;++i){
+        if(indexEntryCount(formatCtx->streams[i])>0){
+            return true;
+        }
+    }
+    return false;
+}
+
+void KeyframeLog::reset(const QVector<ProbeIndexEntry> &known)
+{
+    byDts.clear();
+    for(const ProbeIndexEntry &keyframe:known){
+        byDts.insert(keyframe.timestamp,keyframe);
+    }
+    m_added=0;
+}
+
+//没有dts或位置的包无法用于定位，跳过
+void KeyframeLog::add(const AVPacket *packet)
+{
+    if(!(packet->flags&AV_PKT_FLAG_KEY)||packet->pos<0||packet->dts==AV_NOPTS_VALUE
+        ||byDts.contains(packet->dts)||byDts.size()>=ProbeCache::maxKeyframes){
+        return;
+    }
+    byDts.insert(packet->dts,ProbeIndexEntry{packet->pos,packet->dts,packet->size,0});
+    ++m_added;
+}
+
+QVector<ProbeIndexEntry> KeyframeLog::entries() const
+{
+    return QVector<ProbeIndexEntry>(byDts.cbegin(),byDts.cend());
+}
+
+//先写临时文件再替换，避免读到写了一半的缓存
+int ProbeCache::save(const QString &fileName, AVFormatContext *formatCtx, int videoStream, int audioStream,
+                     bool ownIndex, const KeyframeLog *played)
+{
+    QFileInfo info(localPath(fileName));
+    if(!info.exists()||!formatCtx||!formatCtx->iformat){
+        return -1;
+    }
+
+    QString path=cachePath(fileName);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning()<<"探测缓存：无法写入"<<path;
+        return -1;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out<<probeMagic<<probeVersion<<quint32(avformat_version())
+       <<qint64(info.size())<<qint64(info.lastModified().toMSecsSinceEpoch());
+    out<<QString::fromLatin1(formatCtx->iformat->name)<<qint64(formatCtx->duration)
+       <<qint64(formatCtx->start_time)<<qint64(formatCtx->bit_rate)
+       <<qint32(videoStream)<<qint32(audioStream)<<quint32(formatCtx->nb_streams);
+
+    for(unsigned int i=0;i<formatCtx->nb_streams;++i){
+        const AVStream *st=formatCtx->streams[i];
+        const AVCodecParameters *par=st->codecpar;
+        ProbeStream stream;
+        stream.codecType=par->codec_type;
+        stream.codecId=par->codec_id;
+        stream.codecTag=par->codec_tag;
+        stream.format=par->format;
+        stream.bitRate=par->bit_rate;
+        stream.bitsPerCodedSample=par->bits_per_coded_sample;
+        stream.bitsPerRawSample=par->bits_per_raw_sample;
+        stream.profile=par->profile;
+        stream.level=par->level;
+        stream.width=par->width;
+        stream.height=par->height;
+        stream.sampleAspectRatio=par->sample_aspect_ratio;
+        stream.fieldOrder=par->field_order;
+        stream.colorRange=par->color_range;
+        stream.colorPrimaries=par->color_primaries;
+        stream.colorTrc=par->color_trc;
+        stream.colorSpace=par->color_space;
+        stream.chromaLocation=par->chroma_location;
+        stream.videoDelay=par->video_delay;
+        stream.channelLayout=par->channel_layout;
+        stream.channels=par->channels;
+        stream.sampleRate=par->sample_rate;
+        stream.blockAlign=par->block_align;
+        stream.frameSize=par->frame_size;
+        stream.initialPadding=par->initial_padding;
+        stream.trailingPadding=par->trailing_padding;
+        stream.seekPreroll=par->seek_preroll;
+        stream.extradata=QByteArray(reinterpret_cast<const char*>(par->extradata),par->extradata?par->extradata_size:0);
+        stream.timeBase=st->time_base;
+        stream.avgFrameRate=st->avg_frame_rate;
+        stream.rFrameRate=st->r_frame_rate;
+        stream.startTime=st->start_time;
+        stream.duration=st->duration;
+        stream.nbFrames=st->nb_frames;
+        out<<stream;
+    }
+
+    QVector<ProbeIndexEntry> keyframes;
+    if(videoStream>=0&&videoStream<int(formatCtx->nb_streams)){
+        keyframes=keyframeIndex(formatCtx->streams[videoStream]);
+    }
+    //没有自带索引时，通用索引和播放记录都按dts，合并去重
+    if(!ownIndex&&played){
+        QMap<qint64,ProbeIndexEntry> merged;
+        for(const ProbeIndexEntry &keyframe:played->entries()){
+            merged.insert(keyframe.timestamp,keyframe);
+        }
+        for(const ProbeIndexEntry &keyframe:keyframes){
+            merged.insert(keyframe.timestamp,keyframe);
+        }
+        keyframes=QVector<ProbeIndexEntry>(merged.cbegin(),merged.cend());
+        if(keyframes.size()>maxKeyframes){
+            keyframes.resize(maxKeyframes);
+        }
+    }
+    out<<quint32(keyframes.size());
+    for(const ProbeIndexEntry &keyframe:keyframes){
+        out<<keyframe.pos<<keyframe.timestamp<<keyframe.size<<keyframe.distance;
+    }
+
+    if(!file.commit()){
+        qWarning()<<"探测缓存：写入失败"<<path;
+        return -1;
+    }
+    prune();
+    return keyframes.size();
+}
+
+void ProbeCache::prune()
+{
+    QDir dir(cacheDir());
+    QFileInfoList files=dir.entryInfoList(QStringList()<<"*.probe",QDir::Files,QDir::Time);
+    qint64 total=0;
+    for(const QFileInfo &file:files){
+        total+=file.size();
+    }
+    //按修改时间从新到旧排列，从最旧的开始删除
+    while(total>maxCacheBytes&&!files.isEmpty()){
+        QFileInfo oldest=files.takeLast();
+        total-=oldest.size();
+        QFile::remove(oldest.absoluteFilePath());
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef PROBECACHE_H
+#define PROBECACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QMap>
+#include <QDebug>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+//关键帧索引的一项，对应AVIndexEntry
+struct ProbeIndexEntry{
+    qint64 pos=0;
+    qint64 timestamp=0;
+    qint32 size=0;
+    qint32 distance=0;
+};
+
+//一条流的探测结果：codecpar、时间基和帧率
+struct ProbeStream{
+    qint32 codecType=AVMEDIA_TYPE_UNKNOWN;
+    qint32 codecId=AV_CODEC_ID_NONE;
+    quint32 codecTag=0;
+    qint32 format=-1;
+    qint64 bitRate=0;
+    qint32 bitsPerCodedSample=0;
+    qint32 bitsPerRawSample=0;
+    qint32 profile=0;
+    qint32 level=0;
+    qint32 width=0;
+    qint32 height=0;
+    AVRational sampleAspectRatio{0,1};
+    qint32 fieldOrder=0;
+    qint32 colorRange=0;
+    qint32 colorPrimaries=0;
+    qint32 colorTrc=0;
+    qint32 colorSpace=0;
+    qint32 chromaLocation=0;
+    qint32 videoDelay=0;
+    quint64 channelLayout=0;
+    qint32 channels=0;
+    qint32 sampleRate=0;
+    qint32 blockAlign=0;
+    qint32 frameSize=0;
+    qint32 initialPadding=0;
+    qint32 trailingPadding=0;
+    qint32 seekPreroll=0;
+    QByteArray extradata;
+
+    AVRational timeBase{0,1};
+    AVRational avgFrameRate{0,1};
+    AVRational rFrameRate{0,1};
+    qint64 startTime=AV_NOPTS_VALUE;
+    qint64 duration=AV_NOPTS_VALUE;
+    qint64 nbFrames=0;
+};
+
+//一个文件的探测缓存
+struct ProbeEntry{
+    QString formatName;
+    qint64 duration=AV_NOPTS_VALUE;
+    qint64 startTime=AV_NOPTS_VALUE;
+    qint64 bitRate=0;
+    qint32 videoStream=-1;
+    qint32 audioStream=-1;
+    QVector<ProbeStream> streams;
+    QVector<ProbeIndexEntry> keyframes;     //视频流的关键帧索引
+};
+
+//播放中读到的关键帧包，按dts记录。只保存在这里，不写回解复用器的索引（mov等的索引就是样本表，按dts排列）
+class KeyframeLog
+{
+public:
+    //known为缓存中已有的关键帧，之后只有新读到的才计入added()
+    void reset(const QVector<ProbeIndexEntry> &known = QVector<ProbeIndexEntry>());
+    void add(const AVPacket *packet);
+    QVector<ProbeIndexEntry> entries() const;
+    int added() const{
+        return m_added;
+    }
+
+private:
+    QMap<qint64,ProbeIndexEntry> byDts;
+    int m_added=0;
+};
+
+//持久化的探测缓存：以路径+大小+修改时间为键，重新打开同一文件时跳过avformat_find_stream_info()
+class ProbeCache
+{
+public:
+    static QString cachePath(const QString &fileName);
+
+    //读取有效的缓存；文件已变化或缓存损坏时删除缓存并返回false
+    static bool load(const QString &fileName, ProbeEntry &entry);
+
+    //用缓存填充刚由avformat_open_input()打开的上下文，流结构不一致时返回false；
+    //缓存的关键帧只加入没有自带索引的解复用器
+    static bool apply(AVFormatContext *formatCtx, const ProbeEntry &entry);
+
+    //保存当前上下文的探测结果和关键帧索引，返回保存的关键帧数。
+    //ownIndex为true时只保存解复用器自己的索引；否则再合并played中播放时记录的关键帧
+    static int save(const QString &fileName, AVFormatContext *formatCtx, int videoStream, int audioStream,
+                    bool ownIndex, const KeyframeLog *played = nullptr);
+
+    //刚由avformat_open_input()打开时是否已有索引（mp4的样本表、mkv的Cues等）
+    static bool hasOwnIndex(AVFormatContext *formatCtx);
+
+    //缓存目录超过上限时按最近使用时间删除
+    static void prune();
+
+    static const qint64 maxCacheBytes = 32LL * 1024 * 1024;
+    static const int maxKeyframes = 200000;
+};
+
+#endif // PROBECACHE_H
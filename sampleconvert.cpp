@@ -0,0 +1,114 @@
+#include "sampleconvert.h"
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+#include <QDebug>
+
+extern "C" {
+#include <libswresample/swresample.h>
+#include <libavutil/channel_layout.h>
+}
+
+namespace SampleConvert {
+
+Kernel findKernel(AVSampleFormat format, int channels)
+{
+    switch (format) {
+    case AV_SAMPLE_FMT_U8:   return kernelFor<AV_SAMPLE_FMT_U8>(channels);
+    case AV_SAMPLE_FMT_S16:  return kernelFor<AV_SAMPLE_FMT_S16>(channels);
+    case AV_SAMPLE_FMT_S32:  return kernelFor<AV_SAMPLE_FMT_S32>(channels);
+    case AV_SAMPLE_FMT_FLT:  return kernelFor<AV_SAMPLE_FMT_FLT>(channels);
+    case AV_SAMPLE_FMT_DBL:  return kernelFor<AV_SAMPLE_FMT_DBL>(channels);
+    case AV_SAMPLE_FMT_U8P:  return kernelFor<AV_SAMPLE_FMT_U8P>(channels);
+    case AV_SAMPLE_FMT_S16P: return kernelFor<AV_SAMPLE_FMT_S16P>(channels);
+    case AV_SAMPLE_FMT_S32P: return kernelFor<AV_SAMPLE_FMT_S32P>(channels);
+    case AV_SAMPLE_FMT_FLTP: return kernelFor<AV_SAMPLE_FMT_FLTP>(channels);
+    case AV_SAMPLE_FMT_DBLP: return kernelFor<AV_SAMPLE_FMT_DBLP>(channels);
+    default: return nullptr;
+    }
+}
+
+AVSampleFormat outputFormat(AVSampleFormat format)
+{
+    switch (format) {
+    case AV_SAMPLE_FMT_DBL:
+    case AV_SAMPLE_FMT_DBLP:
+        return AV_SAMPLE_FMT_FLT;
+    default:
+        return av_get_packed_sample_fmt(format);
+    }
+}
+
+int outputBytes(const AVFrame *frame)
+{
+    return av_samples_get_buffer_size(nullptr, frame->channels, frame->nb_samples,
+                                      outputFormat(static_cast<AVSampleFormat>(frame->format)), 1);
+}
+
+int convert(const AVFrame *frame, uint8_t *dst)
+{
+    Kernel kernel = findKernel(static_cast<AVSampleFormat>(frame->format), frame->channels);
+    if (!kernel)
+        return -1;
+    kernel(frame->extended_data, frame->nb_samples, frame->channels, dst);
+    return outputBytes(frame);
+}
+
+//每种格式/声道数各跑iterations次1024样本的转换，统计每样本耗时
+QString benchmark(int iterations)
+{
+    const int nbSamples = 1024;
+    const AVSampleFormat formats[] = {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32P, AV_SAMPLE_FMT_DBLP};
+    const int channelCounts[] = {2, 6};
+    QStringList report;
+    report << QStringLiteral("format  ch   kernel(ns/frame)  swr_convert(ns/frame)  speedup");
+
+    for (AVSampleFormat format : formats) {
+        for (int channels : channelCounts) {
+            AVFrame *frame = av_frame_alloc();
+            frame->format = format;
+            frame->nb_samples = nbSamples;
+            frame->channels = channels;
+            frame->channel_layout = av_get_default_channel_layout(channels);
+            if (av_frame_get_buffer(frame, 0) < 0) {
+                av_frame_free(&frame);
+                continue;
+            }
+            for (int c = 0; c < channels; ++c) {
+                for (int i = 0; i < frame->linesize[0]; ++i)
+                    frame->extended_data[c][i] = uint8_t((i * 31 + c * 7) & 0x3f);
+            }
+
+            AVSampleFormat outFormat = outputFormat(format);
+            QVector<uint8_t> out(outputBytes(frame));
+            uint8_t *outPlanes[1] = {out.data()};
+
+            QElapsedTimer clock;
+            clock.start();
+            for (int k = 0; k < iterations; ++k)
+                convert(frame, out.data());
+            double kernelNs = double(clock.nsecsElapsed()) / iterations / nbSamples;
+
+            SwrContext *swr = swr_alloc_set_opts(nullptr,
+                                                 frame->channel_layout, outFormat, 48000,
+                                                 frame->channel_layout, format, 48000,
+                                                 0, nullptr);
+            double swrNs = 0;
+            if (swr && swr_init(swr) >= 0) {
+                clock.restart();
+                for (int k = 0; k < iterations; ++k)
+                    swr_convert(swr, outPlanes, nbSamples, (const uint8_t **)frame->extended_data, nbSamples);
+                swrNs = double(clock.nsecsElapsed()) / iterations / nbSamples;
+            }
+            swr_free(&swr);
+            av_frame_free(&frame);
+
+            report << QString::asprintf("%-6s  %d   %16.3f  %21.3f  %6.2fx",
+                                        av_get_sample_fmt_name(format), channels,
+                                        kernelNs, swrNs, kernelNs > 0 ? swrNs / kernelNs : 0.0);
+        }
+    }
+    return report.join('\n');
+}
+
+} // namespace SampleConvert
@@ -0,0 +1,214 @@
+#ifndef SAMPLECONVERT_H
+#define SAMPLECONVERT_H
+
+#include <QString>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+}
+
+//把滤镜输出的（平面或交错）样本一次性转换为QAudioSink需要的交错格式
+//按AVSampleFormat和声道数在编译期特化，立体声走SSE2/AVX2/NEON，其余为标量实现
+namespace SampleConvert {
+
+template<AVSampleFormat F> struct FormatTraits;
+template<> struct FormatTraits<AV_SAMPLE_FMT_U8>  { using In=uint8_t; using Out=uint8_t; static constexpr bool planar=false; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_S16> { using In=int16_t; using Out=int16_t; static constexpr bool planar=false; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_S32> { using In=int32_t; using Out=int32_t; static constexpr bool planar=false; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_FLT> { using In=float;   using Out=float;   static constexpr bool planar=false; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_DBL> { using In=double;  using Out=float;   static constexpr bool planar=false; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_U8P> { using In=uint8_t; using Out=uint8_t; static constexpr bool planar=true; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_S16P>{ using In=int16_t; using Out=int16_t; static constexpr bool planar=true; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_S32P>{ using In=int32_t; using Out=int32_t; static constexpr bool planar=true; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_FLTP>{ using In=float;   using Out=float;   static constexpr bool planar=true; };
+template<> struct FormatTraits<AV_SAMPLE_FMT_DBLP>{ using In=double;  using Out=float;   static constexpr bool planar=true; };
+
+//立体声平面→交错的向量化实现，返回已处理的样本数，剩余部分由标量循环完成
+inline int interleaveStereo(const float *l, const float *r, int n, float *out)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(l + i);
+        __m256 b = _mm256_loadu_ps(r + i);
+        __m256 lo = _mm256_unpacklo_ps(a, b);   //l0 r0 l1 r1 | l4 r4 l5 r5
+        __m256 hi = _mm256_unpackhi_ps(a, b);   //l2 r2 l3 r3 | l6 r6 l7 r7
+        _mm256_storeu_ps(out + 2 * i,     _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(l + i);
+        __m128 b = _mm_loadu_ps(r + i);
+        _mm_storeu_ps(out + 2 * i,     _mm_unpacklo_ps(a, b));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(a, b));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 4 <= n; i += 4) {
+        float32x4x2_t v = { { vld1q_f32(l + i), vld1q_f32(r + i) } };
+        vst2q_f32(out + 2 * i, v);
+    }
+#endif
+    return i;
+}
+
+inline int interleaveStereo(const int16_t *l, const int16_t *r, int n, int16_t *out)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(l + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i));
+        __m256i lo = _mm256_unpacklo_epi16(a, b);
+        __m256i hi = _mm256_unpackhi_epi16(a, b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),      _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i),     _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 8 <= n; i += 8) {
+        int16x8x2_t v = { { vld1q_s16(l + i), vld1q_s16(r + i) } };
+        vst2q_s16(out + 2 * i, v);
+    }
+#endif
+    return i;
+}
+
+inline int interleaveStereo(const int32_t *l, const int32_t *r, int n, int32_t *out)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(l + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i));
+        __m256i lo = _mm256_unpacklo_epi32(a, b);
+        __m256i hi = _mm256_unpackhi_epi32(a, b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),     _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i),     _mm_unpacklo_epi32(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 4), _mm_unpackhi_epi32(a, b));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 4 <= n; i += 4) {
+        int32x4x2_t v = { { vld1q_s32(l + i), vld1q_s32(r + i) } };
+        vst2q_s32(out + 2 * i, v);
+    }
+#endif
+    return i;
+}
+
+//double平面→float交错，同时完成精度转换
+inline int interleaveStereo(const double *l, const double *r, int n, float *out)
+{
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    for (; i + 2 <= n; i += 2) {
+        __m128 a = _mm_cvtpd_ps(_mm_loadu_pd(l + i));   //l0 l1 0 0
+        __m128 b = _mm_cvtpd_ps(_mm_loadu_pd(r + i));   //r0 r1 0 0
+        _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(a, b));
+    }
+#elif defined(__aarch64__)
+    for (; i + 2 <= n; i += 2) {
+        float32x2x2_t v = { { vcvt_f32_f64(vld1q_f64(l + i)), vcvt_f32_f64(vld1q_f64(r + i)) } };
+        vst2_f32(out + 2 * i, v);
+    }
+#endif
+    return i;
+}
+
+inline int interleaveStereo(const uint8_t *, const uint8_t *, int, uint8_t *)
+{
+    return 0;
+}
+
+//C为编译期声道数，C==0表示运行时声道数
+template<AVSampleFormat F, int C>
+struct Interleave
+{
+    using In = typename FormatTraits<F>::In;
+    using Out = typename FormatTraits<F>::Out;
+
+    static void run(const uint8_t *const *planes, int n, int channels, uint8_t *dst)
+    {
+        const int ch = C > 0 ? C : channels;
+        Out *out = reinterpret_cast<Out*>(dst);
+
+        if (!FormatTraits<F>::planar) {
+            const In *src = reinterpret_cast<const In*>(planes[0]);
+            if (std::is_same<In, Out>::value) {
+                memcpy(out, src, size_t(n) * ch * sizeof(Out));
+            } else {
+                for (int i = 0; i < n * ch; ++i)
+                    out[i] = Out(src[i]);
+            }
+            return;
+        }
+
+        int i = 0;
+        if (C == 2) {
+            i = interleaveStereo(reinterpret_cast<const In*>(planes[0]),
+                                 reinterpret_cast<const In*>(planes[1]), n, out);
+        }
+        for (int c = 0; c < ch; ++c) {
+            const In *src = reinterpret_cast<const In*>(planes[c]);
+            for (int k = i; k < n; ++k)
+                out[k * ch + c] = Out(src[k]);
+        }
+    }
+};
+
+using Kernel = void (*)(const uint8_t *const *planes, int n, int channels, uint8_t *dst);
+
+//按声道数选择编译期特化的内核，常见声道数之外使用运行时版本
+template<AVSampleFormat F>
+inline Kernel kernelFor(int channels)
+{
+    switch (channels) {
+    case 1: return &Interleave<F, 1>::run;
+    case 2: return &Interleave<F, 2>::run;
+    case 4: return &Interleave<F, 4>::run;
+    case 6: return &Interleave<F, 6>::run;
+    case 8: return &Interleave<F, 8>::run;
+    default: return &Interleave<F, 0>::run;
+    }
+}
+
+Kernel findKernel(AVSampleFormat format, int channels);
+
+//转换后的交错格式：平面格式对应的交错格式，double统一转为float
+AVSampleFormat outputFormat(AVSampleFormat format);
+
+//frame转换后的字节数
+int outputBytes(const AVFrame *frame);
+
+//把frame转换到dst，dst至少需要outputBytes()字节；返回写入的字节数，不支持的格式返回-1
+int convert(const AVFrame *frame, uint8_t *dst);
+
+//与swr_convert对比的微基准，返回可读的结果
+QString benchmark(int iterations = 20000);
+
+} // namespace SampleConvert
+
+#endif // SAMPLECONVERT_H
@@ -0,0 +1,300 @@
+#include "soakrunner.h"
+#include "videoplayer.h"
+#include "avhandles.h"
+#include <QFile>
+#include <QRandomGenerator>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+}
+
+SoakRunner::SoakRunner(int m, QObject *parent)
+    : QObject(parent),
+    minutes(m>0?m:60),
+    timer(new QTimer(this)){
+    connect(timer, &QTimer::timeout, this, &SoakRunner::tick);
+}
+
+SoakRunner::~SoakRunner() {
+    delete player;
+}
+
+//编码一帧并写入，frame为nullptr时冲刷编码器
+static int encodeWrite(AVFormatContext *outCtx, AVCodecContext *enc, AVStream *st, AVFrame *frame)
+{
+    int ret = avcodec_send_frame(enc, frame);
+    if (ret < 0)
+        return ret;
+    PacketPtr packet = makePacket();
+    if (!packet)
+        return AVERROR(ENOMEM);
+    while ((ret = avcodec_receive_packet(enc, packet.get())) >= 0) {
+        av_packet_rescale_ts(packet.get(), enc->time_base, st->time_base);
+        packet->stream_index = st->index;
+        ret = av_interleaved_write_frame(outCtx, packet.get());
+        av_packet_unref(packet.get());
+        if (ret < 0)
+            return ret;
+    }
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+bool SoakRunner::writeSyntheticClip(const QString &path, int seconds, const char *format)
+{
+    const int width = 320;
+    const int height = 240;
+    const int fps = 25;
+    const int sampleRate = 48000;
+    const double twoPi = 6.283185307179586;
+
+    const bool hls = strcmp(format, "hls") == 0;
+
+    AVFormatContext *outCtx = nullptr;
+    if (avformat_alloc_output_context2(&outCtx, nullptr, format, path.toStdString().c_str()) < 0)
+        return false;
+
+    bool ok = false;
+    AVCodec *videoCodec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    //TS不能装PCM，HLS改用MP2
+    AVCodec *audioCodec = avcodec_find_encoder(hls ? AV_CODEC_ID_MP2 : AV_CODEC_ID_PCM_S16LE);
+    AVDictionary *muxOptions = nullptr;
+    int samplesPerFrame = 1024;
+    CodecContextPtr videoEnc(videoCodec ? avcodec_alloc_context3(videoCodec) : nullptr);
+    CodecContextPtr audioEnc(audioCodec ? avcodec_alloc_context3(audioCodec) : nullptr);
+    FramePtr videoFrame = makeFrame();
+    FramePtr audioFrame = makeFrame();
+    AVStream *videoStream = nullptr;
+    AVStream *audioStream = nullptr;
+    int64_t audioPts = 0;
+
+    if (!videoEnc || !audioEnc || !videoFrame || !audioFrame)
+        goto end;
+
+    videoEnc->width = width;
+    videoEnc->height = height;
+    videoEnc->pix_fmt = AV_PIX_FMT_YUV420P;
+    videoEnc->time_base = AVRational{1, fps};
+    videoEnc->framerate = AVRational{fps, 1};
+    videoEnc->gop_size = fps;
+    videoEnc->bit_rate = 400000;
+    audioEnc->sample_fmt = AV_SAMPLE_FMT_S16;
+    audioEnc->sample_rate = sampleRate;
+    audioEnc->channels = 2;
+    audioEnc->channel_layout = AV_CH_LAYOUT_STEREO;
+    audioEnc->time_base = AVRational{1, sampleRate};
+    audioEnc->bit_rate = 192000;
+    if (outCtx->oformat->flags & AVFMT_GLOBALHEADER) {
+        videoEnc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        audioEnc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (avcodec_open2(videoEnc.get(), videoCodec, nullptr) < 0 || avcodec_open2(audioEnc.get(), audioCodec, nullptr) < 0)
+        goto end;
+
+    videoStream = avformat_new_stream(outCtx, nullptr);
+    audioStream = avformat_new_stream(outCtx, nullptr);
+    if (!videoStream || !audioStream)
+        goto end;
+    if (audioEnc->frame_size > 0)
+        samplesPerFrame = audioEnc->frame_size;
+    avcodec_parameters_from_context(videoStream->codecpar, videoEnc.get());
+    avcodec_parameters_from_context(audioStream->codecpar, audioEnc.get());
+    videoStream->time_base = videoEnc->time_base;
+    audioStream->time_base = audioEnc->time_base;
+
+    if (!(outCtx->oformat->flags & AVFMT_NOFILE) && avio_open(&outCtx->pb, path.toStdString().c_str(), AVIO_FLAG_WRITE) < 0)
+        goto end;
+    if (hls) {
+        av_dict_set(&muxOptions, "hls_time", "2", 0);
+        av_dict_set(&muxOptions, "hls_list_size", "0", 0);
+        av_dict_set(&muxOptions, "hls_playlist_type", "vod", 0);
+    }
+    if (avformat_write_header(outCtx, &muxOptions) < 0)
+        goto end;
+
+    videoFrame->format = AV_PIX_FMT_YUV420P;
+    videoFrame->width = width;
+    videoFrame->height = height;
+    audioFrame->format = AV_SAMPLE_FMT_S16;
+    audioFrame->channel_layout = AV_CH_LAYOUT_STEREO;
+    audioFrame->channels = 2;
+    audioFrame->sample_rate = sampleRate;
+    audioFrame->nb_samples = samplesPerFrame;
+    if (av_frame_get_buffer(videoFrame.get(), 0) < 0 || av_frame_get_buffer(audioFrame.get(), 0) < 0)
+        goto end;
+
+    for (int i = 0; i < seconds * fps; ++i) {
+        //移动的渐变，保证每帧都不同，解码和滤镜都有真实的工作量
+        if (av_frame_make_writable(videoFrame.get()) < 0)
+            goto end;
+        for (int y = 0; y < height; ++y) {
+            uint8_t *row = videoFrame->data[0] + y * videoFrame->linesize[0];
+            for (int x = 0; x < width; ++x)
+                row[x] = uint8_t(x + y + i * 3);
+        }
+        for (int y = 0; y < height / 2; ++y) {
+            memset(videoFrame->data[1] + y * videoFrame->linesize[1], 128 + (i % 64), width / 2);
+            memset(videoFrame->data[2] + y * videoFrame->linesize[2], 64 + y / 2, width / 2);
+        }
+        videoFrame->pts = i;
+        if (encodeWrite(outCtx, videoEnc.get(), videoStream, videoFrame.get()) < 0)
+            goto end;
+
+        //音频写到与当前视频帧对齐
+        while (audioPts * fps < int64_t(i + 1) * sampleRate) {
+            if (av_frame_make_writable(audioFrame.get()) < 0)
+                goto end;
+            int16_t *samples = (int16_t *)audioFrame->data[0];
+            for (int n = 0; n < samplesPerFrame; ++n) {
+                int16_t v = int16_t(8000 * std::sin(twoPi * 440.0 * (audioPts + n) / sampleRate));
+                samples[2 * n] = v;
+                samples[2 * n + 1] = v;
+            }
+            audioFrame->pts = audioPts;
+            audioPts += samplesPerFrame;
+            if (encodeWrite(outCtx, audioEnc.get(), audioStream, audioFrame.get()) < 0)
+                goto end;
+        }
+    }
+
+    if (encodeWrite(outCtx, videoEnc.get(), videoStream, nullptr) < 0
+        || encodeWrite(outCtx, audioEnc.get(), audioStream, nullptr) < 0)
+        goto end;
+    ok = av_write_trailer(outCtx) >= 0;
+
+end:
+    av_dict_free(&muxOptions);
+    if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&outCtx->pb);
+    avformat_free_context(outCtx);
+    return ok;
+}
+
+//读取/proc/self/statm的第二项（常驻页数）
+qint64 SoakRunner::residentKB()
+{
+#ifndef Q_OS_LINUX
+    return -1;
+#else
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return -1;
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2)
+        return -1;
+    return fields.at(1).toLongLong() * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+void SoakRunner::start()
+{
+    clipPath = tempDir.filePath("soak.mkv");
+    if (!tempDir.isValid() || !writeSyntheticClip(clipPath, clipSeconds)) {
+        printf("soak: 无法生成测试片段\n");
+        emit finished(2);
+        return;
+    }
+
+    player = new VideoPlayer();
+    player->setAudioSink("null");
+    clock.start();
+    openClip();
+    timer->start(1000);
+    printf("soak: 运行%d分钟，片段%s\n", minutes, qPrintable(clipPath));
+}
+
+//每次重新打开都交替使用探测缓存，覆盖打开和关闭的全部路径
+void SoakRunner::openClip()
+{
+    player->setProbeCacheEnabled(opens % 2 == 0);
+    if (!player->loadFile(clipPath)) {
+        printf("soak: 打开失败\n");
+        return;
+    }
+    player->audioSpeed(2.0);
+    player->play();
+    ++opens;
+}
+
+void SoakRunner::tick()
+{
+    ++ticks;
+    qint64 elapsedSec = clock.elapsed() / 1000;
+    qint64 totalSec = qint64(minutes) * 60;
+    qint64 churnSec = qMin<qint64>(maxChurnSeconds, totalSec / 10);
+    qint64 rss = residentKB();
+    peakKB = qMax(peakKB, rss);
+
+    if (!churning) {
+        //连续播放：累计实际前进的播放时长；到结尾时seek回开头继续，不重新打开
+        qint64 position = player->position();
+        if (lastPosition >= 0 && position > lastPosition && position - lastPosition < 10000) {
+            playedMs += position - lastPosition;
+        }
+        lastPosition = position;
+        if (player->duration() > 0 && (player->state() == VideoPlayer::Ended || position >= player->duration() - 1000)) {
+            player->setPosi(0);
+            lastPosition = 0;
+            ++loops;
+        }
+
+        qint64 warmup = qMin<qint64>(warmupSeconds, (totalSec - churnSec) / 5);
+        if (baselineKB < 0 && elapsedSec >= warmup) {
+            baselineKB = rss;
+        }
+        if (elapsedSec >= totalSec - churnSec) {
+            churning = true;
+            churnStartSec = elapsedSec;
+            churnStartKB = rss;
+            printf("soak: 连续播放结束 %lld s  播放 %lld s  循环 %lld  rss %lld KB  基线 %lld KB，开始反复打开\n",
+                   elapsedSec, playedMs / 1000, loops, rss, baselineKB);
+            fflush(stdout);
+        }
+    } else {
+        //反复打开和seek：每10秒重新打开一次，其余时间每2秒随机seek
+        qint64 churnTicks = elapsedSec - churnStartSec;
+        if (churnTicks % 10 == 0) {
+            openClip();
+        } else if (churnTicks % 2 == 0 && player->duration() > 0) {
+            player->setPosi(QRandomGenerator::global()->bounded(player->duration()));
+            ++seeks;
+        }
+    }
+
+    if (ticks % 60 == 0) {
+        printf("soak: %lld s  rss %lld KB  基线 %lld KB  播放 %lld s  循环 %lld  打开 %lld  seek %lld\n",
+               elapsedSec, rss, baselineKB, playedMs / 1000, loops, opens, seeks);
+        fflush(stdout);
+    }
+
+    if (elapsedSec >= totalSec) {
+        finish();
+    }
+}
+
+//两个阶段分别计算增长；2倍速连续播放的进度至少应跟上实时，否则说明中途卡住或反复缓冲
+void SoakRunner::finish()
+{
+    timer->stop();
+    player->stop();
+    qint64 rss = residentKB();
+    qint64 playbackEndKB = churnStartKB >= 0 ? churnStartKB : rss;
+    qint64 playbackGrowth = baselineKB >= 0 && playbackEndKB >= 0 ? playbackEndKB - baselineKB : 0;
+    qint64 churnGrowth = churnStartKB >= 0 && rss >= 0 ? rss - churnStartKB : 0;
+    qint64 playbackSec = churnStartSec >= 0 ? churnStartSec : clock.elapsed() / 1000;
+    bool continuous = playedMs >= playbackSec * 1000;
+    bool ok = playbackGrowth <= maxGrowthKB && churnGrowth <= maxGrowthKB && continuous;
+    printf("soak: %s  基线 %lld KB  结束 %lld KB  播放阶段增长 %lld KB  打开阶段增长 %lld KB  峰值 %lld KB\n",
+           ok ? "通过" : "失败", baselineKB, rss, playbackGrowth, churnGrowth, peakKB);
+    printf("soak: 连续播放 %lld s（墙钟 %lld s）  循环 %lld  打开 %lld  seek %lld\n",
+           playedMs / 1000, playbackSec, loops, opens, seeks);
+    fflush(stdout);
+    emit finished(ok ? 0 : 1);
+}
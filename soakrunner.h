@@ -0,0 +1,67 @@
+#ifndef SOAKRUNNER_H
+#define SOAKRUNNER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QString>
+#include <QDebug>
+
+class VideoPlayer;
+
+//长时间内存浸泡测试：生成合成片段，大部分时间用实时空音频输出按2倍速连续播放，到结尾时seek回开头而不重新打开；
+//最后一小段时间反复打开和seek。定期采样RSS，连续播放阶段（预热之后）或反复打开阶段的增长超过上限，
+//或连续播放的进度跟不上实时，都以非零退出码结束
+class SoakRunner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SoakRunner(int minutes, QObject *parent = nullptr);
+    ~SoakRunner();
+
+    void start();
+
+    //生成带运动画面（MPEG-4）和正弦音的片段：默认Matroska/PCM；format为"hls"时写2秒一片的TS分片和播放列表，音频用MP2
+    static bool writeSyntheticClip(const QString &path, int seconds, const char *format = "matroska");
+    //当前进程的常驻内存(KB)，不支持的平台返回-1
+    static qint64 residentKB();
+
+    static const int clipSeconds = 120;
+    static const int warmupSeconds = 120;
+    static const int maxChurnSeconds = 300;     //反复打开阶段最长5分钟，不超过总时长的1/10
+    static const qint64 maxGrowthKB = 16 * 1024;
+
+signals:
+    void finished(int exitCode);
+
+private slots:
+    void tick();
+
+private:
+    void openClip();
+    void finish();
+
+    int minutes=60;
+    QTemporaryDir tempDir;
+    QString clipPath;
+    VideoPlayer *player=nullptr;
+    QTimer *timer=nullptr;
+    QElapsedTimer clock;
+    qint64 ticks=0;
+    qint64 opens=0;
+    qint64 seeks=0;
+    qint64 loops=0;
+    qint64 baselineKB=-1;
+    qint64 peakKB=0;
+
+    //连续播放阶段
+    qint64 lastPosition=-1;
+    qint64 playedMs=0;
+    //反复打开阶段
+    bool churning=false;
+    qint64 churnStartSec=-1;
+    qint64 churnStartKB=-1;
+};
+
+#endif // SOAKRUNNER_H
@@ -0,0 +1,409 @@
+#include "videofilter.h"
+#include <QElapsedTimer>
+#include <QVariantMap>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+VideoFilterThread::VideoFilterThread(QObject *parent)
+    : QThread(parent){
+
+}
+
+VideoFilterThread::~VideoFilterThread() {
+    stop();
+    wait();
+}
+
+void VideoFilterThread::stop()
+{
+    QMutexLocker locker(&mutex);
+    stopFlag=true;
+    condition.wakeAll();
+}
+
+void VideoFilterThread::setFilters(const QString &filters)
+{
+    QMutexLocker locker(&mutex);
+    if(m_filters==filters)
+        return;
+    m_filters=filters;
+    ++filtersGeneration;
+}
+
+QString VideoFilterThread::filters()
+{
+    QMutexLocker locker(&mutex);
+    return m_filters;
+}
+
+void VideoFilterThread::setStreamInfo(AVRational timeBase, AVRational frameRate)
+{
+    QMutexLocker locker(&mutex);
+    this->timeBase=timeBase;
+    this->frameRate=frameRate;
+}
+
+void VideoFilterThread::submit(VideoFrame frame)
+{
+    QMutexLocker locker(&mutex);
+    if(frame.serial!=currentSerial){
+        return;
+    }
+    input.push_back(std::move(frame));
+    condition.wakeAll();
+}
+
+void VideoFilterThread::drain(int serial)
+{
+    submit(VideoFrame{FramePtr(),0,serial});
+}
+
+//seek或打开新文件后调用，之前代数的帧不再输出，滤镜图在下一帧时重建
+void VideoFilterThread::flush(int serial)
+{
+    QMutexLocker locker(&mutex);
+    currentSerial=serial;
+    input.clear();
+    output.clear();
+}
+
+bool VideoFilterThread::takeFrame(VideoFrame &frame)
+{
+    QMutexLocker locker(&mutex);
+    if(output.empty()){
+        //在锁内清除标志，保证之后放入的帧一定会再通知一次
+        notifyPending=false;
+        return false;
+    }
+    frame=std::move(output.front());
+    output.pop_front();
+    return true;
+}
+
+//还没有被主线程取走的帧数，包括正在处理的
+int VideoFilterThread::pending()
+{
+    QMutexLocker locker(&mutex);
+    return int(input.size()+output.size())+inFlight;
+}
+
+//每个滤镜处理一帧的平均耗时
+QVariantList VideoFilterThread::stageStats()
+{
+    QMutexLocker locker(&mutex);
+    QVariantList list;
+    for(const StageCost &cost:costs){
+        QVariantMap stage;
+        stage.insert("filter",cost.description);
+        stage.insert("frames",cost.frames);
+        stage.insert("avgMs",cost.frames>0?cost.totalNs/1e6/cost.frames:0.0);
+        list.append(stage);
+    }
+    return list;
+}
+
+//按顶层逗号拆分滤镜链，引号、括号和方括号内的逗号不拆；含多条链或标签时整体作为一个graph
+QStringList VideoFilterThread::splitChain(const QString &filters)
+{
+    QStringList chain;
+    QString trimmed=filters.trimmed();
+    if(trimmed.isEmpty()){
+        return chain;
+    }
+    if(trimmed.contains(';')||trimmed.contains('[')){
+        chain.append(trimmed);
+        return chain;
+    }
+
+    QString current;
+    int depth=0;
+    bool quoted=false;
+    for(int i=0;i<trimmed.size();++i){
+        QChar c=trimmed.at(i);
+        if(c=='\\'&&i+1<trimmed.size()){
+            current+=c;
+            current+=trimmed.at(++i);
+            continue;
+        }
+        if(c=='\''){
+            quoted=!quoted;
+        }else if(!quoted&&c=='('){
+            ++depth;
+        }else if(!quoted&&c==')'){
+            --depth;
+        }else if(!quoted&&depth==0&&c==','){
+            if(!current.trimmed().isEmpty()){
+                chain.append(current.trimmed());
+            }
+            current.clear();
+            continue;
+        }
+        current+=c;
+    }
+    if(!current.trimmed().isEmpty()){
+        chain.append(current.trimmed());
+    }
+    return chain;
+}
+
+//和音频的init_filters()相同：buffer -> 滤镜描述 -> buffersink，开启slice多线程
+bool VideoFilterThread::buildStage(Stage &stage, const char *args)
+{
+    int ret = 0;
+    const AVFilter *buffersrc  = avfilter_get_by_name("buffer");
+    const AVFilter *buffersink = avfilter_get_by_name("buffersink");
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterInOut *inputs  = avfilter_inout_alloc();
+
+    stage.graph = avfilter_graph_alloc();
+    if (!outputs || !inputs || !stage.graph) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    stage.graph->nb_threads = qBound(1, QThread::idealThreadCount(), 8);
+
+    ret = avfilter_graph_create_filter(&stage.src, buffersrc, "in",
+                                       args, nullptr, stage.graph);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot create video buffer source\n");
+        goto end;
+    }
+
+    ret = avfilter_graph_create_filter(&stage.sink, buffersink, "out",
+                                       nullptr, nullptr, stage.graph);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot create video buffer sink\n");
+        goto end;
+    }
+
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = stage.src;
+    outputs->pad_idx    = 0;
+    outputs->next       = nullptr;
+
+    inputs->name       = av_strdup("out");
+    inputs->filter_ctx = stage.sink;
+    inputs->pad_idx    = 0;
+    inputs->next       = nullptr;
+
+    if ((ret = avfilter_graph_parse_ptr(stage.graph, stage.description.toUtf8().constData(),
+                                        &inputs, &outputs, nullptr)) < 0)
+        goto end;
+    if ((ret = avfilter_graph_config(stage.graph, nullptr)) < 0)
+        goto end;
+
+end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    if (ret < 0 && stage.graph) {
+        avfilter_graph_free(&stage.graph);
+        stage.graph = nullptr;
+    }
+
+    return ret >= 0;
+}
+
+//按输入帧的参数依次建立各级graph，上一级buffersink的输出参数作为下一级的输入
+bool VideoFilterThread::buildStages(const AVFrame *frame, const QStringList &chain)
+{
+    freeStages();
+
+    AVRational tb,fr;
+    {
+        QMutexLocker locker(&mutex);
+        tb=timeBase;
+        fr=frameRate;
+    }
+    int width=frame->width;
+    int height=frame->height;
+    int format=frame->format;
+    AVRational sar=frame->sample_aspect_ratio;
+    if(sar.num<=0||sar.den<=0){
+        sar=AVRational{1,1};
+    }
+
+    char args[512];
+    for(const QString &description:chain){
+        snprintf(args, sizeof(args),
+                 "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+                 width, height, format, tb.num, tb.den, sar.num, sar.den);
+        if(fr.num>0&&fr.den>0){
+            size_t len=strlen(args);
+            snprintf(args+len, sizeof(args)-len, ":frame_rate=%d/%d", fr.num, fr.den);
+        }
+
+        Stage stage;
+        stage.description=description;
+        if(!buildStage(stage,args)){
+            qWarning()<<"无法创建视频滤镜"<<description;
+            freeStages();
+            return false;
+        }
+        stages.append(stage);
+
+        width=av_buffersink_get_w(stage.sink);
+        height=av_buffersink_get_h(stage.sink);
+        format=av_buffersink_get_format(stage.sink);
+        tb=av_buffersink_get_time_base(stage.sink);
+        fr=av_buffersink_get_frame_rate(stage.sink);
+        sar=av_buffersink_get_sample_aspect_ratio(stage.sink);
+        if(sar.num<=0||sar.den<=0){
+            sar=AVRational{1,1};
+        }
+    }
+
+    //滤镜链没变时保留累计的耗时
+    QMutexLocker locker(&mutex);
+    bool same=costs.size()==stages.size();
+    for(int i=0;same&&i<stages.size();++i){
+        same=costs.at(i).description==stages.at(i).description;
+    }
+    if(!same){
+        costs.clear();
+        for(const Stage &s:stages){
+            StageCost cost;
+            cost.description=s.description;
+            costs.append(cost);
+        }
+    }
+    return true;
+}
+
+void VideoFilterThread::freeStages()
+{
+    for(Stage &stage:stages){
+        avfilter_graph_free(&stage.graph);
+    }
+    stages.clear();
+}
+
+//frame为nullptr表示输入结束，冲刷各级滤镜（如yadif）中缓存的帧
+void VideoFilterThread::process(FramePtr frame, int serial)
+{
+    int generation;
+    QString filterText;
+    {
+        QMutexLocker locker(&mutex);
+        generation=filtersGeneration;
+        filterText=m_filters;
+    }
+
+    if(!frame){
+        if(stages.isEmpty()||stagesSerial!=serial){
+            freeStages();
+            return;
+        }
+    }else if(stages.isEmpty()||stagesSerial!=serial||stagesGeneration!=generation
+               ||frame->width!=stagesWidth||frame->height!=stagesHeight||frame->format!=stagesFormat){
+        QStringList chain=splitChain(filterText);
+        chain.append("format=rgb24");
+        if(!buildStages(frame.get(),chain)){
+            //用户滤镜无效时只做格式转换，保证能继续播放
+            if(!buildStages(frame.get(),QStringList()<<"format=rgb24")){
+                return;
+            }
+        }
+        stagesSerial=serial;
+        stagesGeneration=generation;
+        stagesWidth=frame->width;
+        stagesHeight=frame->height;
+        stagesFormat=frame->format;
+    }
+
+    bool eof=(frame==nullptr);
+    std::vector<FramePtr> current;
+    current.push_back(std::move(frame));
+    for(int i=0;i<stages.size();++i){
+        QElapsedTimer clock;
+        clock.start();
+        std::vector<FramePtr> next;
+        int inputs=0;
+        for(const FramePtr &f:current){
+            if(!f){
+                av_buffersrc_add_frame(stages[i].src,nullptr);
+                continue;
+            }
+            ++inputs;
+            if(av_buffersrc_add_frame(stages[i].src,f.get())<0){
+                qWarning()<<"无法送入视频滤镜"<<stages[i].description;
+            }
+        }
+        while(true){
+            FramePtr out=makeFrame();
+            if(!out||av_buffersink_get_frame(stages[i].sink,out.get())<0){
+                break;
+            }
+            next.push_back(std::move(out));
+        }
+        if(eof){
+            next.push_back(FramePtr());
+        }
+
+        qint64 elapsed=clock.nsecsElapsed();
+        {
+            QMutexLocker locker(&mutex);
+            if(i<costs.size()&&inputs>0){
+                costs[i].totalNs+=elapsed;
+                costs[i].frames+=inputs;
+            }
+        }
+        current=std::move(next);
+    }
+
+    AVRational sinkTimeBase=stages.isEmpty()?AVRational{1,1000}:av_buffersink_get_time_base(stages.last().sink);
+    {
+        QMutexLocker locker(&mutex);
+        for(FramePtr &f:current){
+            if(!f||serial!=currentSerial){
+                continue;
+            }
+            qint64 pts=f->pts==AV_NOPTS_VALUE?0:av_rescale_q(f->pts,sinkTimeBase,AVRational{1,1000});
+            output.push_back(VideoFrame{std::move(f),pts,serial});
+        }
+    }
+
+    //结束后的graph不能再送入帧，下一帧时重建
+    if(eof){
+        freeStages();
+    }
+}
+
+//滤镜线程入口
+void VideoFilterThread::run()
+{
+    while(true){
+        VideoFrame item;
+        {
+            QMutexLocker locker(&mutex);
+            while(!stopFlag&&input.empty()){
+                condition.wait(&mutex);
+            }
+            if(stopFlag){
+                break;
+            }
+            item=std::move(input.front());
+            input.pop_front();
+            if(item.serial!=currentSerial){
+                continue;
+            }
+            ++inFlight;
+        }
+
+        process(std::move(item.frame),item.serial);
+
+        {
+            QMutexLocker locker(&mutex);
+            --inFlight;
+        }
+        //主线程还没处理上一次通知时不重复发送
+        if(!notifyPending.exchange(true)){
+            emit framesReady();
+        }
+    }
+    freeStages();
+}
@@ -0,0 +1,105 @@
+#ifndef VIDEOFILTER_H
+#define VIDEOFILTER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+#include <QDebug>
+#include <atomic>
+#include <deque>
+#include "avhandles.h"
+
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/frame.h>
+}
+
+//已解码、等待上屏的视频帧，pts为毫秒；只能移动，帧随对象释放
+struct VideoFrame{
+    FramePtr frame;
+    qint64 pts=0;
+    int serial=0;
+};
+
+//视频滤镜线程：解码后的帧在这里经过用户滤镜链（yadif/bwdif、crop、scale等）并转换为RGB24，
+//滤镜链按顶层逗号拆成多个graph依次执行，以便统计每个滤镜的耗时
+class VideoFilterThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit VideoFilterThread(QObject *parent = nullptr);
+    ~VideoFilterThread();
+
+    void run() override;
+    void stop();
+
+    //修改滤镜链，下一帧开始生效，不需要重新打开文件
+    void setFilters(const QString &filters);
+    QString filters();
+    //输入流的时间基和帧率，打开新文件时设置
+    void setStreamInfo(AVRational timeBase, AVRational frameRate);
+
+    //以下由主线程调用
+    void submit(VideoFrame frame);          //frame的所有权转移给滤镜线程，frame->pts为流时间基
+    void drain(int serial);                 //文件结束，取出滤镜中缓存的帧
+    void flush(int serial);                 //丢弃其它代数的帧
+    bool takeFrame(VideoFrame &frame);
+    int pending();
+    QVariantList stageStats();
+
+    static QStringList splitChain(const QString &filters);
+
+signals:
+    void framesReady();
+
+private:
+    struct Stage{
+        QString description;
+        AVFilterGraph *graph=nullptr;
+        AVFilterContext *src=nullptr;
+        AVFilterContext *sink=nullptr;
+    };
+    struct StageCost{
+        QString description;
+        qint64 totalNs=0;
+        qint64 frames=0;
+    };
+
+    bool buildStages(const AVFrame *frame, const QStringList &chain);
+    bool buildStage(Stage &stage, const char *args);
+    void freeStages();
+    void process(FramePtr frame, int serial);
+
+    QMutex mutex;
+    QWaitCondition condition;
+    std::deque<VideoFrame> input;
+    std::deque<VideoFrame> output;
+    int inFlight=0;
+    int currentSerial=0;
+    bool stopFlag=false;
+
+    QString m_filters;
+    int filtersGeneration=0;
+    AVRational timeBase{1,1000};
+    AVRational frameRate{0,1};
+    QList<StageCost> costs;        //与stages一一对应，受mutex保护
+
+    //以下只在滤镜线程中使用
+    QList<Stage> stages;
+    int stagesGeneration=-1;
+    int stagesSerial=-1;
+    int stagesWidth=0;
+    int stagesHeight=0;
+    int stagesFormat=-1;
+    std::atomic<bool> notifyPending{false};
+};
+
+#endif // VIDEOFILTER_H
@@ -1,43 +1,67 @@
 #include "videoplayer.h"
 #include <QDebug>
+#include <QScreen>
+#include <cmath>
 
 
 AudioThread::AudioThread(QObject *parent)
     : QThread(parent),
     audioCodecCtx(nullptr),
     swrCtx(nullptr),
-    audioSink(nullptr),
-    audioIODevice(nullptr),
     buffersink_ctx(nullptr),
     buffersrc_ctx(nullptr),
     filter_graph(nullptr),
     shouldStop(false),
     pauseFlag(false),
     playbackSpeed(1.0),
-    data_size(0){
-
+    data_size(0),
+    audioOutputSpec(qEnvironmentVariable("FFPLAYER_AUDIO_SINK")),
+    worker(new QObject()){
+    worker->moveToThread(this);
 }
 
 AudioThread::~AudioThread() {
     shouldStop=true;
     condition.wakeAll();
+    quit();
     wait();
+    delete audioOutput;
+    delete worker;
+    PacketItem item;
+    while(packetQueue.pop(item)){
+        item.packet.reset();
+    }
+}
+
+//在音频线程中同步执行，线程未运行时直接在当前线程执行
+void AudioThread::runInAudioThread(const std::function<void()> &function)
+{
+    if(!isRunning()||QThread::currentThread()==this){
+        function();
+        return;
+    }
+    QMetaObject::invokeMethod(worker,function,Qt::BlockingQueuedConnection);
+}
+
+//选择音频输出后端，下一次打开文件时生效
+void AudioThread::setAudioOutputSpec(const QString &spec)
+{
+    QMutexLocker locker(&mutex);
+    audioOutputSpec=spec;
 }
 
-//设置播放速度
+//设置播放速度，在音频线程处理Speed命令时调用
 void AudioThread::setPlaybackSpeed(double speed)
 {
     playbackSpeed=speed;
     qDebug()<<"playbackSpeed"<<playbackSpeed;
 
-    QMutexLocker locker(&mutex);
-
     if(filter_graph!=nullptr){
 
         qWarning() << "无法初始化";
         avfilter_graph_free(&filter_graph);
         timerFlag=true;
-        snprintf(filters_descr, sizeof(filters_descr), "atempo=%.1f", playbackSpeed);
+        updateFilterDescr();
 
         if (init_filters(filters_descr) < 0) {
             qWarning() << "无法初始化滤镜图表";
@@ -47,16 +71,148 @@ void AudioThread::setPlaybackSpeed(double speed)
 
 }
 
+//滤镜描述：响度归一化的固定增益（不为0时）加上atempo
+void AudioThread::updateFilterDescr()
+{
+    if (qAbs(gainDb) >= 0.01) {
+        snprintf(filters_descr, sizeof(filters_descr), "volume=%.2fdB,atempo=%.1f", gainDb, playbackSpeed);
+    } else {
+        snprintf(filters_descr, sizeof(filters_descr), "atempo=%.1f", playbackSpeed);
+    }
+}
+
+//设置响度归一化增益(dB)，在下一次重建滤镜图（打开文件、seek或变速）时生效，不打断正在播放的声音
+void AudioThread::setNormalizationGain(double db)
+{
+    runInAudioThread([=]{
+        gainDb=db;
+        updateFilterDescr();
+    });
+}
+
 void AudioThread::pause() {
-    QMutexLocker locker(&mutex);
-    pauseFlag=true;
+    postCommand(PlayerCommand{PlayerCommand::Pause});
 }
 void AudioThread::resume() {
-    QMutexLocker locker(&mutex);
-    if(pauseFlag){
-        pauseFlag=false;
-    }
+    postCommand(PlayerCommand{PlayerCommand::Resume});
+    wakeTimer();
+}
+
+//继续解码但不输出，直到resume()
+void AudioThread::hold() {
+    postCommand(PlayerCommand{PlayerCommand::Hold});
+    wakeTimer();
+}
+
+//暂停时音频线程的定时器已停，投递命令后需要重新启动
+void AudioThread::wakeTimer() {
     condition.wakeAll();
+    QMetaObject::invokeMethod(worker,[this]{
+        if(timer&&!timer->isActive()){
+            timer->start(10);
+        }
+    },Qt::QueuedConnection);
+}
+
+//投递控制命令，由音频线程在下一次processAudio()开始时处理
+void AudioThread::postCommand(const PlayerCommand &command)
+{
+    if(!commandQueue.push(command)){
+        qWarning()<<"音频命令队列已满";
+    }
+}
+
+//处理所有待执行的命令，只在音频线程中调用
+void AudioThread::processCommands()
+{
+    PlayerCommand command;
+    while(commandQueue.pop(command)){
+        switch(command.type){
+        case PlayerCommand::Seek:
+            currentSerial=command.serial;
+            audioTimeLine=command.position;
+            seekPosition=command.position;
+            loopPastEnd=false;
+            loopPlaying=false;
+            flushAudio();
+            break;
+        case PlayerCommand::Flush:
+            currentSerial=command.serial;
+            seekPosition=-1;
+            loopPastEnd=false;
+            loopPlaying=false;
+            flushAudio();
+            break;
+        case PlayerCommand::Pause:
+            pauseFlag=true;
+            suspendOutput(true);
+            break;
+        case PlayerCommand::Resume:
+            pauseFlag=false;
+            holdFlag=false;
+            suspendOutput(false);
+            break;
+        case PlayerCommand::Hold:
+            pauseFlag=false;
+            holdFlag=true;
+            suspendOutput(true);
+            break;
+        case PlayerCommand::Speed:
+            setPlaybackSpeed(command.speed);
+            break;
+        }
+    }
+
+    //暂停时停掉定时器，不再周期性唤醒音频线程，resume()时重新启动
+    if(timer){
+        if(pauseFlag){
+            timer->stop();
+        }else if(!timer->isActive()){
+            timer->start(10);
+        }
+    }
+    publishLevel();
+}
+
+//挂起或恢复输出设备：暂停时设备缓冲里的声音停在原处，processedUSecs()也随之停止
+void AudioThread::suspendOutput(bool suspend)
+{
+    if(!audioOutput||outputSuspended==suspend){
+        return;
+    }
+    outputSuspended=suspend;
+    if(suspend){
+        audioOutput->suspend();
+    }else{
+        audioOutput->resume();
+    }
+}
+
+//音频时钟：最后写入的媒体时间减去设备中还没播放的部分，设备实际播放到哪里时钟就在哪里
+void AudioThread::publishClock()
+{
+    if(!audioOutput||writtenEndMs<0){
+        return;
+    }
+    qint64 pendingUSecs=qMax<qint64>(0,writtenUSecs-audioOutput->processedUSecs());
+    audioTimeLine=qint64(writtenEndMs-pendingUSecs/1000.0*playbackSpeed);
+    emit sendAudioTimeLine(audioTimeLine,currentSerial);
+}
+
+//冲刷解码器，重建滤镜图以丢弃atempo内部缓存的旧样本，清空已解码的PCM
+void AudioThread::flushAudio()
+{
+    if(audioCodecCtx){
+        avcodec_flush_buffers(audioCodecCtx);
+    }
+    audioData.clear();
+    writtenEndMs=-1;
+    if(filter_graph!=nullptr){
+        avfilter_graph_free(&filter_graph);
+        if (init_filters(filters_descr) < 0) {
+            qWarning() << "无法初始化滤镜图表";
+        }
+    }
 }
 void AudioThread::stop() {
     QMutexLocker locker(&mutex);
@@ -64,319 +220,383 @@ void AudioThread::stop() {
     condition.wakeAll();
 }
 
-//暂停和清除音频队列，待完善
+//暂停并清除音频队列，释放滤镜图，之后主线程才能释放解码器
 void AudioThread::deleteAudioSink()
 {
+    runInAudioThread([this]{
+        pauseFlag=true;
+        cleanQueue();
+        if(filter_graph!=nullptr){
+            avfilter_graph_free(&filter_graph);
+        }
+        audioCodecCtx=nullptr;
+    });
+}
 
-    pause();
-
-    cleanQueue();
-
+//设置A-B循环的PCM来源，nullptr表示取消循环；返回后音频线程不再访问旧的来源
+void AudioThread::setLoopSource(LoopBuffer *source)
+{
+    runInAudioThread([=]{
+        loopSource=source;
+        loopEnd=source?source->loopEnd():-1;
+        loopPastEnd=false;
+        loopPlaying=false;
+    });
 }
 
-//接收音频放入队列
-void AudioThread::handleAudioPacket(AVPacket *packet) {
-    QMutexLocker locker(&mutex);
-    packetQueue.enqueue(packet);
+//接收音频放入队列（无锁，只由解复用所在的线程调用），包的所有权转移给音频线程；队列满时丢弃
+void AudioThread::handleAudioPacket(PacketPtr packet, int serial) {
+    if(!packetQueue.push(PacketItem{std::move(packet),serial})){
+        qWarning()<<"音频包队列已满，丢弃";
+        return;
+    }
     condition.wakeOne();
 }
 
 //接收主进程传递的参数
 void AudioThread::receiveAudioParameter(AVFormatContext *format_Ctx, AVCodecContext *audioCodec_Ctx, int *audioStream_Index)
 {
-    formatCtx=format_Ctx;
-    audioCodecCtx=audioCodec_Ctx;
-    audioStreamIndex=audioStream_Index;
+    runInAudioThread([=]{
+        formatCtx=format_Ctx;
+        audioCodecCtx=audioCodec_Ctx;
+        audioStreamIndex=audioStream_Index;
+    });
 }
 
 void AudioThread::conditionWakeAll(){
     condition.wakeAll();
 }
 
-//清除音频队列
+//清除音频队列，只在音频线程中调用
 void AudioThread::cleanQueue(){
-    QMutexLocker locker(&mutex);
-    while(!packetQueue.isEmpty()){
-        AVPacket *packet=packetQueue.dequeue();
-        av_packet_unref(packet);
-        av_packet_free(&packet);
+    PacketItem item;
+    while(packetQueue.pop(item)){
+        item.packet.reset();
     }
     while(!audioData.isEmpty()){
         audioData.dequeue();
     }
-
-    locker.unlock();
 }
 
-//滤镜初始化
+//滤镜初始化，输出固定为解码器的采样格式，与openAudioOutput()按解码器参数打开的输出一致
 int AudioThread::init_filters(const char *filters_descr) {
-    char args[512];
-    int ret = 0;
-    const AVFilter *buffersrc  = avfilter_get_by_name("abuffer");
-    const AVFilter *buffersink = avfilter_get_by_name("abuffersink");
-    AVFilterInOut *outputs = avfilter_inout_alloc();
-    AVFilterInOut *inputs  = avfilter_inout_alloc();
-
-    filter_graph = avfilter_graph_alloc();
-    if (!outputs || !inputs || !filter_graph) {
-        ret = AVERROR(ENOMEM);
-        goto end;
-    }
-
+    filterStartPts = AV_NOPTS_VALUE;
     if (!audioCodecCtx->channel_layout)
         audioCodecCtx->channel_layout =
             av_get_default_channel_layout(audioCodecCtx->channels);
-    snprintf(args, sizeof(args),
-             "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%"PRIx64,
-             audioCodecCtx->time_base.num, audioCodecCtx->time_base.den, audioCodecCtx->sample_rate,
-             av_get_sample_fmt_name(audioCodecCtx->sample_fmt), audioCodecCtx->channel_layout);
-    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in",
-                                       args, nullptr, filter_graph);
-    if (ret < 0) {
-        av_log(nullptr, AV_LOG_ERROR, "Cannot create buffer source\n");
-        goto end;
-    }
-
-    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out",
-                                       nullptr, nullptr, filter_graph);
-    if (ret < 0) {
-        av_log(nullptr, AV_LOG_ERROR, "Cannot create buffer sink\n");
-        goto end;
-    }
-
-
-    outputs->name       = av_strdup("in");
-    outputs->filter_ctx = buffersrc_ctx;
-    outputs->pad_idx    = 0;
-    outputs->next       = nullptr;
-
-    inputs->name       = av_strdup("out");
-    inputs->filter_ctx = buffersink_ctx;
-    inputs->pad_idx    = 0;
-    inputs->next       = nullptr;
-
-    if ((ret = avfilter_graph_parse_ptr(filter_graph, filters_descr,
-                                        &inputs, &outputs, nullptr)) < 0)
-        goto end;
-    if ((ret = avfilter_graph_config(filter_graph, nullptr)) < 0)
-        goto end;
-
-end:
-    avfilter_inout_free(&inputs);
-    avfilter_inout_free(&outputs);
-
-    if(ret<0&& filter_graph){
-        avfilter_graph_free(&filter_graph);
-        filter_graph=nullptr;
-
-    }
-
-    return ret;
+    return createAudioFilterGraph(audioCodecCtx, audioCodecCtx->time_base, filters_descr,
+                                  audioCodecCtx->sample_fmt, &filter_graph,
+                                  &buffersrc_ctx, &buffersink_ctx);
 }
 
 //音频播放
 void AudioThread::processAudio()
 {
-    AudioData audioDataTemp;
     if (shouldStop) {
         quit();
         return;
     }
-    //QMutexLocker locker(&mutex);
+    processCommands();
+
     if (pauseFlag) {
         return;
     }
 
-    int bytesFree = audioSink->bytesFree();
-    if (!audioData.isEmpty() && bytesFree >= audioData.head().buffer.size()) {
+    if (!audioOutput || !audioCodecCtx || !filter_graph) {
+        return;
+    }
+
+    //丢弃seek之前解码出的PCM
+    while (!audioData.isEmpty() && audioData.head().serial != currentSerial) {
+        audioData.dequeue();
+    }
+
+    qint64 bytesFree = audioOutput->bytesFree();
+    if (holdFlag) {
+        //预缓冲中，只积累PCM
+    } else if (!audioData.isEmpty() && bytesFree >= audioData.head().buffer.size()) {
         AudioData dataTemp = audioData.dequeue();
-        audioTimeLine = dataTemp.pts + dataTemp.duration + audioSink->bufferSize() / data_size * dataTemp.duration;
-        emit sendAudioTimeLine(audioTimeLine);
-        qDebug() << "audioTimeLine" << audioTimeLine;
-        audioIODevice->write(dataTemp.buffer);
+        qint64 written = audioOutput->write(dataTemp.buffer);
+        if (written > 0) {
+            qint64 usecs = format.durationForBytes(int(written));
+            writtenUSecs += usecs;
+            writtenEndMs = dataTemp.pts + usecs / 1000.0 * playbackSpeed;
+        }
     } else {
         qDebug() << "duration_error";
     }
+    if (!holdFlag) {
+        publishClock();
+    }
+
+    //越过B点后从循环缓冲取PCM，时间戳已按圈数递增
+    if (loopSource && loopPastEnd && loopSource->isReady()) {
+        loopPlaying = true;
+        AudioData loopData;
+        while (audioData.size() < 8 && loopSource->takeAudio(currentSerial, loopData)) {
+            audioData.enqueue(loopData);
+        }
+    }
+
+    //预缓冲时不输出，每次多解几个包，尽快达到目标时长
+    int budget = holdFlag ? 4 : 1;
+    bool decoded = false;
+    while (budget-- > 0 && decodePacket()) {
+        decoded = true;
+    }
+    publishLevel();
 
-    if (packetQueue.isEmpty()) {
+    if (decoded) {
+        emit audioProcessed();
+    }
+}
+
+//取出当前代数的一个音频包，解码、经过滤镜后放入PCM队列；没有可用的包或出错时返回false
+bool AudioThread::decodePacket()
+{
+    //PCM已达上限时不取包，包留在队列里；主线程看到水位后也会停止解复用
+    if (queuedMs() >= maxBufferedMs) {
+        return false;
+    }
 
+    AudioData audioDataTemp;
+    PacketItem item;
+    bool havePacket = false;
+    while (packetQueue.pop(item)) {
+        //新代数的包可能比命令先被看到，先处理命令再判断
+        if (item.serial != currentSerial) {
+            processCommands();
+        }
+        if (item.serial == currentSerial) {
+            havePacket = true;
+            break;
+        }
+        item.packet.reset();
+    }
+    if (!havePacket) {
         qDebug() << "packetQueue.isEmpty()" ;
-        return;
-        //condition.wait(&mutex);
-        if (shouldStop) return;
+        return false;
+    }
+    if (!audioCodecCtx || !filter_graph) {
+        return false;
     }
-    if (!packetQueue.isEmpty()) {
-        AVPacket *packet = packetQueue.dequeue();
 
-        AVFrame *frame = av_frame_alloc();
-        if (!frame) {
-            qWarning() << "无法分配音频帧";
-            return;
+    FramePtr frame = makeFrame();
+    FramePtr filt_frame = makeFrame();
+    if (!frame || !filt_frame) {
+        qWarning() << "无法分配音频帧";
+        return false;
+    }
+
+    int ret = avcodec_send_packet(audioCodecCtx, item.packet.get());
+    item.packet.reset();
+    if (ret < 0) {
+        qWarning() << "无法发送音频包到解码器";
+        return false;
+    }
+
+    //一个包可能解出多帧，每帧用完后unref，帧对象在整个循环中复用
+    while (true) {
+        ret = avcodec_receive_frame(audioCodecCtx, frame.get());
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
+        } else if (ret < 0) {
+            qWarning() << "无法接收解码后的音频帧";
+            break;
         }
 
-        int ret = avcodec_send_packet(audioCodecCtx, packet);
+        originalPts = frame->pts * av_q2d(formatCtx->streams[*audioStreamIndex]->time_base) * 1000;
+
+        ret = av_buffersrc_add_frame(buffersrc_ctx, frame.get());
+        av_frame_unref(frame.get());
         if (ret < 0) {
-            qWarning() << "无法发送音频包到解码器";
-            av_packet_unref(packet);
-            av_packet_free(&packet);
-            av_frame_free(&frame);
-            return;
+            qWarning() << "无法将音频帧送入滤镜链";
+            break;
         }
 
-        while (ret >= 0) {
-            ret = avcodec_receive_frame(audioCodecCtx, frame);
+        while (true) {
+            ret = av_buffersink_get_frame(buffersink_ctx, filt_frame.get());
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                av_frame_free(&frame);
                 break;
             } else if (ret < 0) {
-                qWarning() << "无法接收解码后的音频帧";
-                av_frame_free(&frame);
+                qWarning() << "无法从滤镜链获取处理后的音频帧";
                 break;
             }
+            if (filt_frame->nb_samples <= 0) {
+                qWarning() << "滤镜数据nb_samples<=0";
+                av_frame_unref(filt_frame.get());
+                continue;
+            }
+            if (filt_frame->extended_data == nullptr || !filt_frame->data[0]) {
+                qWarning() << "滤镜数据为空";
+                av_frame_unref(filt_frame.get());
+                continue;
+            }
 
-            originalPts = frame->pts * av_q2d(formatCtx->streams[*audioStreamIndex]->time_base) * 1000;
-
-            if (av_buffersrc_add_frame(buffersrc_ctx, frame) < 0) {
-                qWarning() << "无法将音频帧送入滤镜链";
-                av_frame_free(&frame);
+            //平面格式只拷贝data[0]会丢掉其余声道，这里统一转换为交错格式
+            data_size = SampleConvert::outputBytes(filt_frame.get());
+            if (data_size < 0) {
+                qWarning() << "无法获取缓冲区大小";
+                av_frame_unref(filt_frame.get());
                 break;
             }
 
-            while (true) {
-                AVFrame *filt_frame = av_frame_alloc();
-                if (!filt_frame) {
-                    qWarning() << "无法分配滤镜后的音频帧";
-                    break;
-                }
 
-                ret = av_buffersink_get_frame(buffersink_ctx, filt_frame);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                    av_frame_free(&filt_frame);
-                    break;
-                } else if (ret < 0) {
-                    qWarning() << "无法从滤镜链获取处理后的音频帧";
-                    av_frame_free(&filt_frame);
-                    break;
-                }
-                if (!filt_frame || filt_frame->nb_samples <= 0) {
-                    qWarning() << "滤镜数据nb_samples<=0";
-                    av_frame_free(&filt_frame);
+            //atempo输出的第一帧pts就是输入的媒体时间，之后每个输出样本对应speed个输入样本
+            if (filterStartPts == AV_NOPTS_VALUE) {
+                filterStartPts = filt_frame->pts;
+            }
+
+            audioDataTemp.duration = filt_frame->nb_samples * 1000.0 / filt_frame->sample_rate;
+            audioDataTemp.pts = originalPts;
+            audioDataTemp.serial = currentSerial;
+
+            //精确seek：跳过目标位置之前的样本
+            if (seekPosition >= 0) {
+                if (audioDataTemp.pts + audioDataTemp.duration < seekPosition) {
+                    av_frame_unref(filt_frame.get());
                     continue;
                 }
-                if (!filt_frame->data[0][0]) {
-                    qWarning() << "滤镜数据为空";
-                    av_frame_free(&filt_frame);
-                    continue;
+                seekPosition = -1;
+            }
+            qDebug() << "audioDataTemp.duration" << audioDataTemp.duration;
+            qDebug() << "audioDataTemp.pts" << audioDataTemp.pts;
+
+            audioDataTemp.buffer = QByteArray(data_size, Qt::Uninitialized);
+            if (SampleConvert::convert(filt_frame.get(), (uint8_t*)audioDataTemp.buffer.data()) < 0) {
+                qWarning() << "不支持的采样格式" << av_get_sample_fmt_name((AVSampleFormat)filt_frame->format);
+                av_frame_unref(filt_frame.get());
+                continue;
+            }
+
+            //A-B循环：B点之后的样本丢弃，跨过B点的一块按样本截断到B点。
+            //B点先换算成sink时间基，再按速度映射到atempo的输出位置
+            if (loopEnd >= 0) {
+                qint64 keep;
+                if (filt_frame->pts != AV_NOPTS_VALUE && filterStartPts != AV_NOPTS_VALUE) {
+                    AVRational sinkTimeBase = av_buffersink_get_time_base(buffersink_ctx);
+                    int64_t endPts = av_rescale_q(loopEnd, AVRational{1, 1000}, sinkTimeBase);
+                    int64_t endOutPts = filterStartPts + llround((endPts - filterStartPts) / playbackSpeed);
+                    keep = av_rescale_q(endOutPts - filt_frame->pts, sinkTimeBase, AVRational{1, filt_frame->sample_rate});
+                } else {
+                    keep = qint64((loopEnd - audioDataTemp.pts) / playbackSpeed * filt_frame->sample_rate / 1000);
                 }
-                if (filt_frame->extended_data == nullptr) {
-                    qWarning() << "滤镜数据extended_data";
-                    av_frame_free(&filt_frame);
+                if (loopPlaying || keep <= 0) {
+                    loopPastEnd = true;
+                    av_frame_unref(filt_frame.get());
                     continue;
                 }
-
-                data_size = av_samples_get_buffer_size(nullptr, filt_frame->channels,
-                                                       filt_frame->nb_samples,
-                                                       (AVSampleFormat)filt_frame->format, 1);
-                if (data_size < 0) {
-                    qWarning() << "无法获取缓冲区大小";
-                    av_frame_unref(filt_frame);
-                    break;
+                if (keep < filt_frame->nb_samples) {
+                    audioDataTemp.buffer.truncate(keep * (data_size / filt_frame->nb_samples));
+                    audioDataTemp.duration = keep * 1000.0 / filt_frame->sample_rate;
+                    loopPastEnd = true;
                 }
-
-
-                audioDataTemp.duration = ((filt_frame->nb_samples * 1000) / filt_frame->sample_rate);
-                audioDataTemp.pts = originalPts;
-                qDebug() << "audioDataTemp.duration" << audioDataTemp.duration;
-                qDebug() << "audioDataTemp.pts" << audioDataTemp.pts;
-
-                audioDataTemp.buffer = QByteArray((char*)filt_frame->data[0], data_size);
-                audioData.enqueue(audioDataTemp);
-                qDebug() << "audioData.size()" << audioData.size();
-
-
-
-                av_frame_free(&filt_frame);
             }
+            audioData.enqueue(audioDataTemp);
+            qDebug() << "audioData.size()" << audioData.size();
 
-            av_frame_free(&frame);
+            av_frame_unref(filt_frame.get());
         }
-
-        av_packet_unref(packet);
-        av_packet_free(&packet);
     }
 
-    emit audioProcessed();
+    return true;
+}
+
+//当前代数已解码、还在队列中的PCM时长(ms)
+qint64 AudioThread::queuedMs() const
+{
+    double ms = 0;
+    for (const AudioData &data : audioData) {
+        if (data.serial == currentSerial) {
+            ms += data.duration;
+        }
+    }
+    return qint64(ms);
+}
 
+//公布当前代数已解码未播放的PCM时长，主线程据此判断预缓冲是否完成以及是否欠载
+void AudioThread::publishLevel()
+{
+    qint64 ms = queuedMs();
+    //预缓冲时设备里剩下的可能是seek之前的数据，不计入
+    if (audioOutput && !holdFlag) {
+        ms += format.durationForBytes(int(audioOutput->bufferSize() - audioOutput->bytesFree())) / 1000;
+    }
+    levelMs.store(ms, std::memory_order_relaxed);
+    levelSerial.store(currentSerial, std::memory_order_release);
 }
 
 //返回音频类型
 QAudioFormat::SampleFormat AudioThread::ffmpegToQtSampleFormat(AVSampleFormat ffmpegFormat) {
     switch (ffmpegFormat) {
-    case AV_SAMPLE_FMT_U8:   return QAudioFormat::UInt8;
-    case AV_SAMPLE_FMT_S16:  return QAudioFormat::Int16;
-    case AV_SAMPLE_FMT_S32:  return QAudioFormat::Int32;
-    case AV_SAMPLE_FMT_FLT:  return QAudioFormat::Float;
-    case AV_SAMPLE_FMT_DBL:  // Qt没有直接对应的64位浮点格式
-    case AV_SAMPLE_FMT_U8P:  // 平面格式
-    case AV_SAMPLE_FMT_S16P: // 平面格式
-    case AV_SAMPLE_FMT_S32P: // 平面格式
-    case AV_SAMPLE_FMT_FLTP: // 平面格式
-    case AV_SAMPLE_FMT_DBLP: // 平面格式unknown
+    //平面格式由SampleConvert转换为对应的交错格式，double转换为float
+    case AV_SAMPLE_FMT_U8:
+    case AV_SAMPLE_FMT_U8P:  return QAudioFormat::UInt8;
+    case AV_SAMPLE_FMT_S16:
+    case AV_SAMPLE_FMT_S16P: return QAudioFormat::Int16;
+    case AV_SAMPLE_FMT_S32:
+    case AV_SAMPLE_FMT_S32P: return QAudioFormat::Int32;
+    case AV_SAMPLE_FMT_FLT:
+    case AV_SAMPLE_FMT_FLTP:
+    case AV_SAMPLE_FMT_DBL:
+    case AV_SAMPLE_FMT_DBLP:
     default: return QAudioFormat::Float;
     }
 }
 
-//初始化音频
-void AudioThread::initAudioThread(){
-
-    if(filter_graph!=nullptr){
-        avfilter_graph_free(&filter_graph);
-    }
-
-    timerFlag=true;
-    snprintf(filters_descr, sizeof(filters_descr), "atempo=%.1f", playbackSpeed);
-
-
-    outputDevices=new QMediaDevices();
-    outputDevice=outputDevices->defaultAudioOutput();
-    //format=outputDevice.preferredFormat();
+//按解码器参数打开音频输出，重新打开前释放旧的输出
+bool AudioThread::openAudioOutput(){
 
     format.setSampleRate(audioCodecCtx->sample_rate);
     format.setChannelCount(audioCodecCtx->channels);
     //format.setSampleFormat(QAudioFormat::Float);
     format.setSampleFormat(ffmpegToQtSampleFormat(audioCodecCtx->sample_fmt));
 
+    QMutexLocker locker(&mutex);
+    if(audioOutput){
+        audioOutput->stop();
+        delete audioOutput;
+    }
+    audioOutput=AudioOutput::create(audioOutputSpec);
+    outputSuspended=false;
+    writtenUSecs=0;
+    writtenEndMs=-1;
+    return audioOutput->start(format);
+}
+
+//初始化音频，在音频线程中执行，保证音频输出和滤镜只被一个线程使用
+void AudioThread::initAudioThread(){
+    runInAudioThread([this]{
+        if(filter_graph!=nullptr){
+            avfilter_graph_free(&filter_graph);
+        }
+
+        timerFlag=true;
+        updateFilterDescr();
 
-    audioSink = new QAudioSink(outputDevice, format);
-    audioIODevice =audioSink->start();
 
+        if (!openAudioOutput()) {
+            qWarning() << "无法打开音频输出";
+        }
 
-    if (init_filters(filters_descr) < 0) {
-        qWarning() << "无法初始化滤镜图表";
-        return;
-    }
 
+        if (init_filters(filters_descr) < 0) {
+            qWarning() << "无法初始化滤镜图表";
+            return;
+        }
+    });
 }
 
 //初始化音频，开始timer
 void AudioThread::run() {
 
     timerFlag=true;
-    snprintf(filters_descr, sizeof(filters_descr), "atempo=%.1f", playbackSpeed);
-
-
-    outputDevices=new QMediaDevices();
-    outputDevice=outputDevices->defaultAudioOutput();
-    //format=outputDevice.preferredFormat();
-
-    format.setSampleRate(audioCodecCtx->sample_rate);
-    format.setChannelCount(audioCodecCtx->channels);
-    //format.setSampleFormat(QAudioFormat::Float);
-    format.setSampleFormat(ffmpegToQtSampleFormat(audioCodecCtx->sample_fmt));
+    updateFilterDescr();
 
 
-    audioSink = new QAudioSink(outputDevice, format);
-    audioIODevice =audioSink->start();
+    if (!openAudioOutput()) {
+        qWarning() << "无法打开音频输出";
+    }
 
 
     if (init_filters(filters_descr) < 0) {
@@ -384,10 +604,13 @@ void AudioThread::run() {
         return;
     }
 
-    timer = new QTimer(this);
-    connect(timer, &QTimer::timeout, this, &AudioThread::processAudio);
+    //定时器和回调都在音频线程中，processAudio()在本线程执行
+    timer = new QTimer();
+    connect(timer, &QTimer::timeout, worker, [this]{ processAudio(); });
     timer->start(10); // 每10ms触发一次
     exec();
+    delete timer;
+    timer = nullptr;
     avfilter_graph_free(&filter_graph);
 
 }
@@ -401,19 +624,54 @@ VideoPlayer::VideoPlayer(QQuickItem *parent)
     swrCtx(nullptr),
     timer(new QTimer(this)),
     customTimebase(0),
-    audioThread(new AudioThread(this)) {
+    audioThread(new AudioThread(this)),
+    exportThread(new ExportThread(this)),
+    bufferTimer(new QTimer(this)),
+    seekTimer(new QTimer(this)) {
+    seekTimer->setSingleShot(true);
+    seekTimer->setInterval(30);
+    presentTimer=new QTimer(this);
+    presentTimer->setSingleShot(true);
+    presentTimer->setTimerType(Qt::PreciseTimer);
+    presentClock.start();
+    connect(presentTimer, &QTimer::timeout, this, [this]{
+        //等待frameSwapped超时（窗口被遮挡或最小化时不会渲染），重新调度
+        presentPending=false;
+        schedulePresentation();
+    });
+    connect(this, &QQuickItem::windowChanged, this, &VideoPlayer::handleWindowChanged);
+    videoFilter=new VideoFilterThread(this);
+    m_videoFilters=qEnvironmentVariable("FFPLAYER_VIDEO_FILTERS");
+    videoFilter->setFilters(m_videoFilters);
+    connect(videoFilter, &VideoFilterThread::framesReady, this, &VideoPlayer::onFilteredFrames);
+    capturePool=new QThreadPool(this);
+    loudnessAnalyzer=new LoudnessAnalyzer(this);
+    connect(loudnessAnalyzer, &LoudnessAnalyzer::analysisFinished, this, &VideoPlayer::onLoudnessAnalyzed);
+    capturePool->setMaxThreadCount(qBound(1,QThread::idealThreadCount()/2,4));
+    connect(seekTimer, &QTimer::timeout, this, &VideoPlayer::doPreviewSeek);
+    timer->setInterval(1000 / 150);//用150是保证2倍数时,数据量足够，避免出现卡顿。
     connect(timer, &QTimer::timeout, this, &VideoPlayer::onTimeout);
-    connect(this,&VideoPlayer::deliverPacketToAudio,audioThread,&AudioThread::handleAudioPacket);
+    stateTimer=new QTimer(this);
+    stateTimer->setInterval(20);
+    connect(stateTimer, &QTimer::timeout, this, &VideoPlayer::updatePlaybackState);
+    connect(bufferTimer, &QTimer::timeout, this, &VideoPlayer::checkBuffer);
     connect(audioThread,&AudioThread::sendAudioTimeLine,this,&VideoPlayer::receiveAudioTimeLine);
     connect(this,&VideoPlayer::sendAudioParameter,audioThread,&AudioThread::receiveAudioParameter);
-    connect(this,&VideoPlayer::sendSpeed,audioThread,&AudioThread::setPlaybackSpeed);
+    connect(exportThread,&ExportThread::progressChanged,this,&VideoPlayer::exportProgress);
+    connect(exportThread,&ExportThread::exportFinished,this,&VideoPlayer::exportFinished);
     avformat_network_init();
     av_register_all(); // 注册所有编解码器
     avfilter_register_all();
 }
 
 VideoPlayer::~VideoPlayer() {
+    capturePool->waitForDone();
+    cancelExport();
+    exportThread->wait();
     stop();
+    releaseLoop();
+    videoFilter->stop();
+    videoFilter->wait();
     audioThread->quit();
     audioThread->wait();
     delete audioThread;
@@ -422,19 +680,115 @@ VideoPlayer::~VideoPlayer() {
 
 
 //打开视频文件，如果打开成功，qml中执行 play（）；文件选择用的 qml
+//打开后立即开始预缓冲，play()时队列通常已经达到目标，可以直接开始播放
 bool VideoPlayer::loadFile(const QString &fileName) {
     stop();
+    setState(Opening);
+    if (!openFile(fileName)) {
+        setState(Idle);
+        return false;
+    }
+    //网络输入在后台打开，完成后由onNetworkOpened()开始预缓冲
+    if (!demuxThread) {
+        beginPreroll(Prerolling);
+    }
+    return true;
+}
+
+//打开文件并初始化解码器和音频线程，不开始解复用
+bool VideoPlayer::openFile(const QString &fileName) {
+    openClock.start();
+    if (NetworkCache::isNetworkUrl(fileName)) {
+        return openNetwork(fileName);
+    }
     formatCtx = avformat_alloc_context();
-    if (avformat_open_input(&formatCtx, fileName.toStdString().c_str(), nullptr, nullptr) != 0) {
+    AVDictionary *openOptions=nullptr;
+
+    //本地文件先查探测缓存，命中时指定封装格式并跳过avformat_find_stream_info()
+    ProbeEntry probeEntry;
+    probeCacheHit = m_probeCacheEnabled && ProbeCache::load(fileName, probeEntry);
+    AVInputFormat *inputFormat = probeCacheHit ? av_find_input_format(probeEntry.formatName.toLatin1().constData()) : nullptr;
+
+    int openRet = avformat_open_input(&formatCtx, fileName.toStdString().c_str(), inputFormat, &openOptions);
+    av_dict_free(&openOptions);
+    if (openRet != 0) {
         qWarning() << "无法打开文件";
         return false;
     }
 
-    if (avformat_find_stream_info(formatCtx, nullptr) < 0) {
-        qWarning() << "无法获取流信息";
+    //在探测和应用缓存之前判断，之后通用索引或缓存的关键帧会让它不再为空
+    videoOwnIndex = ProbeCache::hasOwnIndex(formatCtx);
+    keyframeLog.reset();
+
+    if (probeCacheHit && !ProbeCache::apply(formatCtx, probeEntry)) {
+        qWarning() << "探测缓存与文件不一致，重新探测";
+        probeCacheHit = false;
+    }
+
+    if (probeCacheHit) {
+        videoStreamIndex = probeEntry.videoStream;
+        audioStreamIndex = probeEntry.audioStream;
+        keyframeLog.reset(probeEntry.keyframes);
+    } else {
+        if (avformat_find_stream_info(formatCtx, nullptr) < 0) {
+            qWarning() << "无法获取流信息";
+            return false;
+        }
+
+        findStreams();
+
+        if (m_probeCacheEnabled && videoStreamIndex != -1 && audioStreamIndex != -1) {
+            ProbeCache::save(fileName, formatCtx, videoStreamIndex, audioStreamIndex, videoOwnIndex);
+        }
+    }
+    return setupStreams(fileName);
+}
+
+//网络输入：装上预读缓存，打开、探测和解复用都在DemuxThread中进行，网络阻塞不会卡住界面
+bool VideoPlayer::openNetwork(const QString &fileName) {
+    AVFormatContext *ctx = avformat_alloc_context();
+    if (!ctx) {
         return false;
     }
+    //HLS的播放列表和分片也经由缓存打开
+    networkCache = new NetworkCache(this);
+    networkCache->attach(ctx, fileName);
+    AVDictionary *openOptions=nullptr;
+    av_dict_set(&openOptions, "http_persistent", "0", 0);
+
+    probeCacheHit = false;
+    videoOwnIndex = true;        //网络输入不写探测缓存，不需要记录关键帧
+    keyframeLog.reset();
+    demuxThread = new DemuxThread(ctx, fileName, openOptions, ++openToken, this);
+    av_dict_free(&openOptions);
+    connect(demuxThread, &DemuxThread::opened, this, &VideoPlayer::onNetworkOpened);
+    pendingSource = fileName;
+    demuxThread->start();
+    return true;
+}
+
+//网络输入打开完成，在界面线程中继续初始化解码器
+void VideoPlayer::onNetworkOpened(int token, bool ok)
+{
+    if (!demuxThread || token != openToken) {
+        return;
+    }
+    formatCtx = ok ? demuxThread->takeContext() : nullptr;
+    if (!formatCtx) {
+        qWarning() << "无法打开文件";
+        stop();
+        return;
+    }
+    findStreams();
+    if (!setupStreams(pendingSource)) {
+        stop();
+        return;
+    }
+    demuxThread->startReading(playSerial);
+    beginPreroll(Prerolling);
+}
 
+void VideoPlayer::findStreams() {
     for (unsigned int i = 0; i < formatCtx->nb_streams; ++i) {
         if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
             videoStreamIndex = i;
@@ -442,6 +796,11 @@ bool VideoPlayer::loadFile(const QString &fileName) {
             audioStreamIndex = i;
         }
     }
+}
+
+//根据已探测的流打开解码器，初始化滤镜和音频线程
+bool VideoPlayer::setupStreams(const QString &fileName) {
+    qint64 probeMs = openClock.elapsed();
 
     if (videoStreamIndex == -1) {
         qWarning() << "未找到视频流";
@@ -492,44 +851,87 @@ bool VideoPlayer::loadFile(const QString &fileName) {
 
     emit sendAudioParameter(formatCtx,audioCodecCtx,&audioStreamIndex);
 
+    //归一化增益要在下面重建音频滤镜之前确定
+    startLoudness(fileName);
+
+    //新文件开始新的播放代数
+    ++playSerial;
+    resetFrameStats();
+    videoFilter->setStreamInfo(formatCtx->streams[videoStreamIndex]->time_base,
+                               formatCtx->streams[videoStreamIndex]->avg_frame_rate);
+    videoFilter->flush(playSerial);
+    if(!videoFilter->isRunning()){
+        videoFilter->start();
+    }
+    audioThread->postCommand(PlayerCommand{PlayerCommand::Flush,playSerial});
+
     if(!audioThread->isRunning()){
         audioThread->start();
     }else{
         audioThread->initAudioThread();
     }
-    audioThread->resume();
 
     m_duration=formatCtx->duration / AV_TIME_BASE *1000;
 
     emit durationChanged(m_duration);
 
     customTimebase=0;
+    m_fileName=fileName;
+    emit sourceChanged();
+
+    m_openStats.insert("probeCacheHit", probeCacheHit);
+    m_openStats.insert("probeMs", probeMs);
+    m_openStats.remove("firstFrameMs");
+    emit openStatsChanged();
+
+    if(networkCache){
+        bufferTimer->start(200);
+    }
 
     return true;
 }
 
+//timer只负责解复用和解码，上屏由渲染循环驱动
+//预缓冲中只记下播放的意图，达到目标后由finishPreroll()开始；暂停或结束后重新预缓冲，队列已满时立即开始
 void VideoPlayer::play() {
-    if (!timer->isActive()) {
-       timer->start(1000 / 150);//用150是保证2倍数时,数据量足够，避免出现卡顿。
+    m_playing=true;
+    if (m_state==Paused||m_state==Ended) {
+        beginPreroll(Prerolling);
     }
 }
 
 void VideoPlayer::pause() {
+    if (!formatCtx) {
+        return;
+    }
 
-    if (timer->isActive()) {
+    //预缓冲、缓冲或seek中按暂停，直接转为用户暂停，完成后停在Paused
+    if (m_state==Prerolling||m_state==Buffering||m_state==Seeking) {
+        m_playing=!m_playing;
+        return;
+    }
+
+    //暂停后不再有任何定时器运行，直到恢复播放
+    if (m_state==Playing) {
+        m_playing=false;
         timer->stop();
+        presentTimer->stop();
+        stateTimer->stop();
         audioThread->pause();
+        setClock(qint64(mediaClockAt(presentNow())));
+        setState(Paused);
     }else{
-        timer->start();
-        audioThread->resume();
+        play();
     }
 
 }
 
 void VideoPlayer::stop() {
+    m_playing=false;
     if (timer->isActive()) {
         timer->stop();
     }
+    presentTimer->stop();
     cleanup();
 }
 
@@ -540,22 +942,18 @@ void VideoPlayer::paint(QPainter *painter) {
     }
 }
 
-//接收音频时间线，调整视频时间线。
-void VideoPlayer::receiveAudioTimeLine(qint64 timeLine)
+//接收音频时间线，调整视频时间线。seek之前发出的时间线直接丢弃
+void VideoPlayer::receiveAudioTimeLine(qint64 timeLine, int serial)
 {
-    customTimebase=timeLine+15;
+    if(serial!=playSerial){
+        return;
+    }
+    setClock(timeLine+15);
 }
 
 //视频队列清空
 void VideoPlayer::cleanVideoPacketQueue(){
-    //QMutexLocker locker(&mutex);
-    while(!videoPacketQueue.isEmpty()){
-        //packetQueue.dequeue();
-        AVPacket *packet=videoPacketQueue.dequeue();
-        av_packet_unref(packet);
-        av_packet_free(&packet);
-    }
-    //locker.unlock();
+    videoPacketQueue.clear();
 }
 
 //定义了Q_PROPERTY(qint64 position READ position WRITE setPosition NOTIFY positionChanged) 必须要有
@@ -574,50 +972,273 @@ void VideoPlayer::setPosition(int p){
 }
 
 //查找定位，用于进度条拖拽。
+//只在本线程处理视频和解复用；音频的冲刷通过Seek命令交给音频线程，旧代数的数据由各级自行丢弃
 void VideoPlayer::setPosi(qint64 position){
 
-
-    if (timer->isActive()) {
-        timer->stop();
-    }else{
-
+    if(!formatCtx){
+        return;
     }
-    audioThread->deleteAudioSink();
+
+    int serial=++playSerial;
+    audioThread->postCommand(PlayerCommand{PlayerCommand::Seek,serial,position});
+    videoFilter->flush(serial);
+    resetLoopState(serial);
+    clearHistory();
 
     qint64 target_ts=position*1000;
 
     avcodec_flush_buffers(videoCodecCtx);
-    avcodec_flush_buffers(audioCodecCtx);
 
     cleanVideoPacketQueue();
+    clearFrameQueue();
+    demuxEof=false;
+    audioDemuxMs=-1;
+    videoDemuxMs=-1;
+    videoDrained=false;
 
     //if(av_seek_frame(formatCtx,-1,target_ts,AVSEEK_FLAG_BACKWARD)<0){
-    if(avformat_seek_file(formatCtx,-1,INT64_MIN,target_ts,INT64_MAX,AVSEEK_FLAG_BACKWARD)){   //这方法查找更准确
+    if(demuxThread){
+        demuxThread->seek(serial,target_ts);
+    }else if(avformat_seek_file(formatCtx,-1,INT64_MIN,target_ts,INT64_MAX,AVSEEK_FLAG_BACKWARD)){   //这方法查找更准确
         qWarning()<<"无法跳转到指定位置";
         return;
     }
 
-    if (timer->isActive()) {
+    //新位置的PCM和帧达到预缓冲目标后再继续，视频不必等音频追上
+    m_playing=true;
+    beginPreroll(Seeking);
 
-    }else{
-        timer->start();
+    m_position=position;
+    setClock(position);
+    seekTarget=position;
+    seekClock.start();
+    //turnPoint=position;
+    emit positionChanged(m_position);
+
+}
+
+//拖动进度条时调用：只记录最新目标，由seekTimer合并后做一次关键帧预览
+void VideoPlayer::seekPreview(qint64 position){
+    if(!formatCtx){
+        return;
+    }
+    if(timer->isActive()){
+        timer->stop();
+        audioThread->pause();
     }
+    m_playing=false;
+    presentTimer->stop();
+    stateTimer->stop();
+    setState(Seeking);
+    pendingSeek=position;
+    if(!seekTimer->isActive()){
+        seekTimer->start();
+    }
+}
 
-    audioThread->resume();
+//松开进度条时调用：丢弃还没执行的预览，做一次精确seek并继续播放
+void VideoPlayer::seekCommit(qint64 position){
+    seekTimer->stop();
+    pendingSeek=-1;
+    setPosi(position);
+}
+
+//关键帧预览：跳到目标之前最近的关键帧，只解码这一帧显示
+void VideoPlayer::doPreviewSeek(){
+    if(!formatCtx||pendingSeek<0){
+        return;
+    }
+    qint64 position=pendingSeek;
+    pendingSeek=-1;
+
+    previewClock.start();
+    seekClock.invalidate();
+
+    //新代数让之前未完成的精确seek和所有在途数据失效
+    int serial=++playSerial;
+    audioThread->postCommand(PlayerCommand{PlayerCommand::Seek,serial,position});
+    videoFilter->flush(serial);
+    resetLoopState(serial);
+    clearHistory();
+    previewSerial=serial;
+    seekTarget=-1;
+
+    avcodec_flush_buffers(videoCodecCtx);
+    cleanVideoPacketQueue();
+    clearFrameQueue();
+    demuxEof=false;
+    audioDemuxMs=-1;
+    videoDemuxMs=-1;
+    videoDrained=false;
+
+    //网络输入不做同步的关键帧预览，只把解复用线程移到目标位置，松开后由seekCommit()显示
+    if(demuxThread){
+        demuxThread->seek(serial,position*1000);
+        previewSerial=-1;
+        m_position=position;
+        setClock(position);
+        emit positionChanged(m_position);
+        return;
+    }
+
+    if(avformat_seek_file(formatCtx,-1,INT64_MIN,position*1000,INT64_MAX,AVSEEK_FLAG_BACKWARD)<0){
+        qWarning()<<"无法跳转到指定位置";
+        return;
+    }
+
+    PacketPtr packet=makePacket();
+    FramePtr frame=makeFrame();
+    if(!packet||!frame){
+        return;
+    }
+
+    videoCodecCtx->skip_frame=AVDISCARD_NONKEY;
+    bool shown=false;
+    for(int i=0;i<maxPreviewPackets&&!shown;++i){
+        if(av_read_frame(formatCtx,packet.get())<0){
+            break;
+        }
+        if(packet->stream_index==videoStreamIndex&&(packet->flags&AV_PKT_FLAG_KEY)){
+            //送入关键帧后立即冲刷，避免解码器的帧延迟
+            if(avcodec_send_packet(videoCodecCtx,packet.get())>=0){
+                avcodec_send_packet(videoCodecCtx,nullptr);
+                if(avcodec_receive_frame(videoCodecCtx,frame.get())>=0){
+                    //预览帧同样经过滤镜，滤镜输出后在onFilteredFrames()中显示
+                    submitFrame(std::move(frame));
+                    videoFilter->drain(serial);
+                    shown=true;
+                }
+            }
+            avcodec_flush_buffers(videoCodecCtx);
+        }
+        av_packet_unref(packet.get());
+    }
+    videoCodecCtx->skip_frame=AVDISCARD_DEFAULT;
+
+    if(!shown){
+        previewSerial=-1;
+    }
 
     m_position=position;
-    customTimebase=position;
-    //turnPoint=position;
+    setClock(position);
     emit positionChanged(m_position);
-
 }
 
 //发送速度参数给音频滤镜
 void VideoPlayer::audioSpeed(qreal speed)
 {
-    double s=speed;
-    emit sendSpeed(s);
+    PlayerCommand command;
+    command.type=PlayerCommand::Speed;
+    command.speed=speed;
+    audioThread->postCommand(command);
+
+    //以当前媒体时间重新锚定，之后按新速度外推
+    setClock(qint64(mediaClockAt(presentNow())));
+    playbackRate=speed>0?speed:1.0;
+
+    //循环缓冲中的PCM按旧速度生成，重新建立
+    if(loopBuffer){
+        setLoop(m_loopA,m_loopB);
+    }
+
+}
+
+//把当前文件按指定速度导出到磁盘，在独立线程中尽可能快地运行
+bool VideoPlayer::exportFile(const QString &outputFile, qreal speed)
+{
+    if(m_fileName.isEmpty()){
+        qWarning()<<"没有打开的文件，无法导出";
+        return false;
+    }
+    if(exportThread->isRunning()){
+        qWarning()<<"导出任务正在进行";
+        return false;
+    }
+    QUrl url(outputFile);
+    exportThread->setJob(m_fileName,url.isLocalFile()?url.toLocalFile():outputFile,speed);
+    exportThread->start();
+    return true;
+}
+
+void VideoPlayer::cancelExport()
+{
+    exportThread->cancel();
+}
+
+//关闭探测缓存后每次打开都完整探测，用于对比首帧时间
+void VideoPlayer::setProbeCacheEnabled(bool enabled)
+{
+    if(m_probeCacheEnabled==enabled)
+        return;
+    m_probeCacheEnabled=enabled;
+    emit probeCacheEnabledChanged();
+}
+
+//选择音频输出："qt"、"null"、"null:fast"、"wav:路径"、"wav-fast:路径"
+void VideoPlayer::setAudioSink(const QString &spec)
+{
+    if(m_audioSink==spec)
+        return;
+    m_audioSink=spec;
+    audioThread->setAudioOutputSpec(spec);
+    emit audioSinkChanged();
+}
+
+void VideoPlayer::setLowWatermark(int ms)
+{
+    if(m_lowWatermark==ms)
+        return;
+    m_lowWatermark=ms;
+    emit watermarkChanged();
+}
+
+void VideoPlayer::setHighWatermark(int ms)
+{
+    if(m_highWatermark==ms)
+        return;
+    m_highWatermark=ms;
+    emit watermarkChanged();
+}
+
+//网络缓冲水位检查：低于低水位暂停解复用进入Buffering，达到高水位或下载完成后恢复解复用，
+//队列重新达到预缓冲目标后由updatePlaybackState()继续播放，避免断断续续地卡顿
+void VideoPlayer::checkBuffer()
+{
+    if(!networkCache||!formatCtx)
+        return;
 
+    qint64 bitRate=formatCtx->bit_rate;
+    if(bitRate<=0){
+        for(unsigned int i=0;i<formatCtx->nb_streams;++i){
+            bitRate+=formatCtx->streams[i]->codecpar->bit_rate;
+        }
+    }
+    NetworkCache::Stats stats=networkCache->updateStats(bitRate);
+
+    m_networkStats.insert("bandwidth",stats.bandwidth);
+    m_networkStats.insert("bufferedBytes",stats.bufferedBytes);
+    m_networkStats.insert("bufferedMs",stats.bufferedMs);
+    m_networkStats.insert("spilledBytes",stats.spilledBytes);
+    m_networkStats.insert("reconnects",stats.reconnects);
+    m_networkStats.insert("prefetchedSegments",stats.prefetchedSegments);
+    m_networkStats.insert("finished",stats.finished);
+    emit networkStatsChanged();
+
+    if(networkStarved){
+        networkPercent=m_highWatermark>0?int(qBound<qint64>(0,stats.bufferedMs*100/m_highWatermark,99)):99;
+        if(stats.finished||stats.bufferedMs>=m_highWatermark){
+            networkStarved=false;
+            networkPercent=100;
+            if(m_state==Buffering){
+                timer->start();
+            }
+        }
+    }else if(m_state==Playing&&!stats.finished&&stats.bufferedMs<m_lowWatermark){
+        qDebug()<<"缓冲不足，暂停等待"<<stats.bufferedMs;
+        networkStarved=true;
+        networkPercent=0;
+        beginPreroll(Buffering);
+    }
 }
 
 //主线程延迟标准程序
@@ -628,87 +1249,388 @@ void VideoPlayer::delay(int milliseconds) {
     }
 }
 
-//定时器，定时执行内容
+//定时器，定时执行内容：解复用并提前解码，不负责上屏
 void VideoPlayer::onTimeout() {
-    AVPacket *packet=av_packet_alloc();
+    //A-B循环：音视频都越过B点（或到文件尾）后回到A点
+    if (m_loopB >= 0 && !loopFromBuffer && (demuxEof || (loopVideoPast && loopAudioPast))) {
+        wrapLoop();
+        return;
+    }
+    if (loopFromBuffer) {
+        decodeVideo();
+        return;
+    }
+    if (demuxFull()) {
+        decodeVideo();
+        return;
+    }
+
+    PacketPtr packet=makePacket();
     if(!packet) return;
 
-    if (av_read_frame(formatCtx, packet) >= 0) {
+    //网络输入从解复用线程取包，还没有数据时等下一次
+    int ret=demuxThread?demuxThread->takePacket(packet,playSerial):av_read_frame(formatCtx, packet.get());
+    if (ret == AVERROR(EAGAIN)) {
+        decodeVideo();
+        return;
+    }
+    if (ret >= 0) {
+        rememberPacket(packet.get());
+        //记录两路最近读到的时间；音频流提前结束或很稀疏时不再等待PCM
+        if (packet->pts != AV_NOPTS_VALUE) {
+            qint64 ms = packet->pts * av_q2d(formatCtx->streams[packet->stream_index]->time_base) * 1000;
+            //seek后的第一个包作为起点，之后只跟踪音频
+            if (packet->stream_index == audioStreamIndex || audioDemuxMs < 0) {
+                audioDemuxMs = ms;
+            }
+            if (packet->stream_index == videoStreamIndex) {
+                videoDemuxMs = ms;
+            }
+        }
+        if (packet->stream_index == audioStreamIndex && m_loopB >= 0 && packet->pts != AV_NOPTS_VALUE
+            && packet->pts * av_q2d(formatCtx->streams[audioStreamIndex]->time_base) * 1000 >= m_loopB) {
+            //B点之后的音频仍送给音频线程，由它截断并切换到循环缓冲
+            loopAudioPast = true;
+        }
         if (packet->stream_index == videoStreamIndex) {
-            videoPacketQueue.enqueue(packet);
+            //读到的关键帧只记录下来，关闭时写入探测缓存，下次打开可直接定位
+            if (!videoOwnIndex) {
+                keyframeLog.add(packet.get());
+            }
+            videoPacketQueue.push_back(PacketItem{std::move(packet),playSerial});
 
             decodeVideo();
         } else if (packet->stream_index == audioStreamIndex) {
-            AVPacket *audioPacket=av_packet_alloc();
-            if(!audioPacket){
-                av_packet_unref(packet);
-                av_packet_free(&packet);
-                return;
-            }
-            av_packet_ref(audioPacket,packet);
-
-            emit deliverPacketToAudio(audioPacket);
+            //包直接交给音频线程，不再额外引用一份
+            audioThread->handleAudioPacket(std::move(packet),playSerial);
         }
     }else{
+        if(ret==AVERROR_EOF){
+            demuxEof=true;
+        }
         decodeVideo();
+        //所有帧都已解码，停止解复用定时器，剩余的帧由渲染循环显示；循环时由wrapLoop()回到A点
+        if(videoDrained&&m_loopB<0){
+            timer->stop();
+        }
     }
 }
 
 
-//解码视频，并刷新
+//高水位：视频包积压到上限，或PCM已满且视频也有待解码的包时暂停读取。
+//只有PCM满而视频没有包时继续读，否则视频会等不到数据
+bool VideoPlayer::demuxFull() const
+{
+    if (videoPacketQueue.size() >= size_t(maxQueuedVideoPackets)) {
+        return true;
+    }
+    bool audioFull = audioThread->bufferedSerial() == playSerial && audioThread->bufferedMs() >= AudioThread::maxBufferedMs;
+    return audioFull && !videoPacketQueue.empty();
+}
+
+//解码视频包，放入待显示队列，队列满时等下一次再解
 void VideoPlayer::decodeVideo() {
 
-    if(videoPacketQueue.isEmpty()){
+    //丢弃旧代数的视频包
+    while(!videoPacketQueue.empty()&&videoPacketQueue.front().serial!=playSerial){
+        videoPacketQueue.pop_front();
+    }
+
+    //还在滤镜线程中的帧也计入预解码数量
+    int buffered=int(frameQueue.size())+videoFilter->pending();
+
+    //循环缓冲已解码好的帧，直接送入滤镜
+    if(loopFromBuffer){
+        VideoFrame loopFrame;
+        while(buffered<maxDecodedFrames&&loopBuffer->takeVideo(playSerial,loopFrame)){
+            submitFrame(std::move(loopFrame.frame));
+            ++buffered;
+        }
         return;
     }
 
-    AVPacket *packet=videoPacketQueue.first();
-    qint64 videoPts=packet->pts*av_q2d(formatCtx->streams[videoStreamIndex]->time_base)*1000;//转换为毫秒
+    while(!videoPacketQueue.empty()&&buffered<maxDecodedFrames){
+        PacketPtr packet=std::move(videoPacketQueue.front().packet);
+        videoPacketQueue.pop_front();
+        int ret = avcodec_send_packet(videoCodecCtx, packet.get());
+        if (ret < 0) {
+            qWarning() << "无法发送视频包到解码器";
+            continue;
+        }
+        receiveVideoFrames();
+        buffered=int(frameQueue.size())+videoFilter->pending();
+    }
+
+    //文件结束后冲刷解码器和滤镜，取出缓存的最后几帧
+    if(demuxEof&&!videoDrained&&videoPacketQueue.empty()&&buffered<maxDecodedFrames){
+        avcodec_send_packet(videoCodecCtx, nullptr);
+        receiveVideoFrames();
+        videoFilter->drain(playSerial);
+        videoDrained=true;
+    }
+}
+
+//取出解码器中所有可用的帧
+void VideoPlayer::receiveVideoFrames() {
+    while(true){
+        FramePtr frame = makeFrame();
+        if (!frame) {
+            qWarning() << "无法分配视频帧";
+            return;
+        }
+        int ret = avcodec_receive_frame(videoCodecCtx, frame.get());
+        if (ret < 0) {
+            if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+                qWarning() << "无法接收解码后的视频帧";
+            }
+            return;
+        }
+        submitFrame(std::move(frame));
+    }
+}
 
-    if(videoPts>(customTimebase)){
+//送入滤镜线程，frame的pts统一为流时间基下的best_effort_timestamp；送入后所有权归滤镜线程
+void VideoPlayer::submitFrame(FramePtr frame) {
+    if(!frame){
         return;
+    }
+    AVRational timeBase=formatCtx->streams[videoStreamIndex]->time_base;
+    qint64 framePts;
+    if(frame->best_effort_timestamp!=AV_NOPTS_VALUE){
+        framePts=frame->best_effort_timestamp*av_q2d(timeBase)*1000;
+        frame->pts=frame->best_effort_timestamp;
     }else{
-        packet=videoPacketQueue.dequeue();
+        framePts=frameQueue.empty()?m_position:frameQueue.back().pts;
+        frame->pts=av_rescale_q(framePts,AVRational{1,1000},timeBase);
     }
 
-    AVFrame *frame = av_frame_alloc();
-    if (!frame) {
-        qWarning() << "无法分配视频帧";
-        av_packet_unref(packet);
-        av_packet_free(&packet);
+    //精确seek：目标位置之前的帧只解码不显示
+    if(seekTarget>=0){
+        if(frame->best_effort_timestamp!=AV_NOPTS_VALUE&&framePts<seekTarget){
+            return;
+        }
+        seekTarget=-1;
+    }
+
+    //主解码路径B点之后的帧不显示，之后由循环缓冲接上
+    if(m_loopB>=0&&!loopFromBuffer&&frame->best_effort_timestamp!=AV_NOPTS_VALUE&&framePts>=m_loopB){
+        loopVideoPast=true;
         return;
     }
 
-    int ret = avcodec_send_packet(videoCodecCtx, packet);
-    if (ret < 0) {
-        qWarning() << "无法发送视频包到解码器";
-        av_frame_free(&frame);
-        av_packet_unref(packet);
-        av_packet_free(&packet);
+    videoFilter->submit(VideoFrame{std::move(frame),framePts,playSerial});
+}
+
+//取出滤镜线程的输出：预览帧立即显示，播放的帧放入待显示队列，队列从空变为非空时触发一次调度
+void VideoPlayer::onFilteredFrames() {
+    VideoFrame videoFrame;
+    bool wasEmpty=frameQueue.empty();
+    while(videoFilter->takeFrame(videoFrame)){
+        if(videoFrame.serial!=playSerial){
+            continue;
+        }
+        if(videoFrame.serial==previewSerial){
+            presentFrame(videoFrame.frame.get());
+            lastFrame=std::move(videoFrame.frame);
+            previewSerial=-1;
+            m_previewLatency=previewClock.elapsed();
+            emit seekLatencyChanged();
+            continue;
+        }
+        frameQueue.push_back(std::move(videoFrame));
+    }
+    if(wasEmpty&&!frameQueue.empty()&&!presentTimer->isActive()){
+        schedulePresentation();
+    }
+}
+
+//运行时修改视频滤镜，下一帧生效
+void VideoPlayer::setVideoFilters(const QString &filters)
+{
+    if(m_videoFilters==filters)
         return;
+    m_videoFilters=filters;
+    videoFilter->setFilters(filters);
+    emit videoFiltersChanged();
+}
+
+void VideoPlayer::clearFrameQueue() {
+    frameQueue.clear();
+}
+
+bool VideoPlayer::presenting() const {
+    return m_playing&&m_state==Playing;
+}
+
+double VideoPlayer::presentNow() const {
+    return presentClock.nsecsElapsed()/1e6;
+}
+
+//更新媒体时钟的锚点，之后按播放速度外推
+void VideoPlayer::setClock(qint64 timeLine) {
+    customTimebase=timeLine;
+    clockWall=presentNow();
+}
+
+//预测某一时刻的媒体时间；暂停或音频时钟长时间不更新时不再外推
+double VideoPlayer::mediaClockAt(double wallMs) const {
+    if(!presenting()){
+        return customTimebase;
     }
+    double elapsed=qBound(0.0,wallMs-clockWall,double(maxExtrapolation));
+    return customTimebase+elapsed*playbackRate;
+}
+
+double VideoPlayer::wallForMedia(double mediaMs) const {
+    return clockWall+(mediaMs-customTimebase)/playbackRate;
+}
 
-    ret = avcodec_receive_frame(videoCodecCtx, frame);
-    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-        av_frame_free(&frame);
-        av_packet_unref(packet);
-        av_packet_free(&packet);
+//wallMs之后的第一个vsync，还没有收到过frameSwapped时直接返回wallMs
+double VideoPlayer::nextVsyncAfter(double wallMs) const {
+    if(vsyncLast<=0){
+        return wallMs;
+    }
+    double n=std::ceil((wallMs-vsyncLast)/vsyncInterval);
+    return vsyncLast+qMax(1.0,n)*vsyncInterval;
+}
+
+//选出与下一个vsync最匹配的帧提交显示；还没有到期的帧则定时在它的前一个vsync唤醒
+void VideoPlayer::schedulePresentation() {
+    presentTimer->stop();
+    if(!presenting()||presentPending){
         return;
-    } else if (ret < 0) {
-        qWarning() << "无法接收解码后的视频帧";
-        av_frame_free(&frame);
-        av_packet_unref(packet);
-        av_packet_free(&packet);
+    }
+
+    while(!frameQueue.empty()&&frameQueue.front().serial!=playSerial){
+        frameQueue.pop_front();
+    }
+    if(frameQueue.empty()){
+        return;     //解码出新帧时会再次调度
+    }
+
+    double now=presentNow();
+    double target=nextVsyncAfter(now+renderMargin);
+    double tolerance=vsyncInterval*playbackRate/2;
+    double mediaAt=mediaClockAt(target);
+
+    int pick=-1;
+    for(int i=0;i<int(frameQueue.size());++i){
+        if(frameQueue[i].pts>mediaAt+tolerance){
+            break;
+        }
+        pick=i;
+    }
+
+    if(pick<0){
+        //至少等到刚才预测的vsync，避免音频时钟停住时空转
+        double due=wallForMedia(frameQueue.front().pts-tolerance);
+        double wait=qMax(due-vsyncInterval-now,target-now);
+        presentTimer->start(qBound(1,int(wait),1000));
         return;
     }
 
-    av_packet_unref(packet);
-    av_packet_free(&packet);
+    //赶不上的帧直接丢弃，不做颜色转换
+    for(int i=0;i<pick;++i){
+        frameQueue.pop_front();
+        ++framesSkipped;
+    }
 
+    VideoFrame videoFrame=std::move(frameQueue.front());
+    frameQueue.pop_front();
+    presentDue=wallForMedia(videoFrame.pts);
+    presentTarget=target;
+    presentPending=true;
 
-    m_position=customTimebase;            //以音频轴更新视频轴
+    m_position=loopPosition(videoFrame.pts);
     emit positionChanged(m_position);
 
+    presentFrame(videoFrame.frame.get());
+    lastFrame=std::move(videoFrame.frame);
+
+    presentTimer->start(100);
+}
+
+//渲染线程交换缓冲后在主线程执行：更新vsync估计，统计上一帧的上屏时间，再调度下一帧
+void VideoPlayer::onFrameSwapped() {
+    double swap=lastSwapNs.load(std::memory_order_acquire)/1e6;
+
+    if(vsyncLast>0){
+        double diff=swap-vsyncLast;
+        int n=qRound(diff/vsyncInterval);
+        if(n>=1&&n<=8){
+            vsyncInterval+=(diff/n-vsyncInterval)*0.05;
+        }
+    }
+    vsyncLast=swap;
+
+    if(presentPending){
+        presentPending=false;
+        presentTimer->stop();
+        ++framesPresented;
+
+        double lateness=swap-presentDue;
+        if(lateness>vsyncInterval){
+            framesRepeated+=qint64(lateness/vsyncInterval);
+        }
+
+        //实际上屏时间相对预测vsync的偏差，指数加权的均值和方差
+        const double alpha=0.05;
+        double diff=(swap-presentTarget)-jitterMean;
+        double increment=alpha*diff;
+        jitterMean+=increment;
+        jitterVar=(1-alpha)*(jitterVar+diff*increment);
+
+        updateFrameStats(false);
+    }
+
+    schedulePresentation();
+}
+
+//跟随所在窗口的frameSwapped，时间戳在渲染线程中记录
+void VideoPlayer::handleWindowChanged(QQuickWindow *window) {
+    if(swapConnection){
+        disconnect(swapConnection);
+    }
+    if(!window){
+        return;
+    }
+    if(window->screen()&&window->screen()->refreshRate()>0){
+        vsyncInterval=1000.0/window->screen()->refreshRate();
+    }
+    vsyncLast=0;
+    swapConnection=connect(window,&QQuickWindow::frameSwapped,this,[this]{
+        lastSwapNs.store(presentClock.nsecsElapsed(),std::memory_order_release);
+        QMetaObject::invokeMethod(this,&VideoPlayer::onFrameSwapped,Qt::QueuedConnection);
+    },Qt::DirectConnection);
+}
+
+void VideoPlayer::resetFrameStats() {
+    framesPresented=0;
+    framesRepeated=0;
+    framesSkipped=0;
+    jitterMean=0;
+    jitterVar=0;
+    updateFrameStats(true);
+}
+
+//帧节奏统计，最多每500ms通知一次
+void VideoPlayer::updateFrameStats(bool force) {
+    double now=presentNow();
+    if(!force&&now-lastStatsEmit<500){
+        return;
+    }
+    lastStatsEmit=now;
+    m_frameStats.insert("presented",framesPresented);
+    m_frameStats.insert("repeated",framesRepeated);
+    m_frameStats.insert("skipped",framesSkipped);
+    m_frameStats.insert("jitterMs",std::sqrt(jitterVar));
+    m_frameStats.insert("refreshMs",vsyncInterval);
+    m_frameStats.insert("filters",videoFilter->stageStats());
+    emit frameStatsChanged();
+}
+
+//转换为QImage并刷新，同时记录seek到出画面的延迟
+void VideoPlayer::presentFrame(AVFrame *frame) {
 
     if(m_videoWidth!=frame->width||m_videoHeight!=frame->height){
         m_videoWidth=frame->width;
@@ -716,39 +1638,68 @@ void VideoPlayer::decodeVideo() {
         emit videoWidthChanged();
         emit videoHeightChanged();
     }
-    // 缩放视频帧
-    AVFrame *rgbFrame = av_frame_alloc();
-    if (!rgbFrame) {
-        qWarning() << "无法分配RGB视频帧";
-        av_frame_free(&frame);
-        return;
-    }
-    rgbFrame->format = AV_PIX_FMT_RGB24;
-    rgbFrame->width = videoCodecCtx->width;
-    rgbFrame->height = videoCodecCtx->height;
-    ret = av_frame_get_buffer(rgbFrame, 0);
-    if (ret < 0) {
-        qWarning() << "无法分配RGB视频帧数据缓冲区";
-        av_frame_free(&frame);
-        av_frame_free(&rgbFrame);
-        return;
+    //滤镜线程已经输出RGB24，直接拷贝
+    if (frame->format == AV_PIX_FMT_RGB24) {
+        currentImage = QImage(frame->data[0], frame->width, frame->height, frame->linesize[0], QImage::Format_RGB888).copy();
+    } else {
+        // 缩放视频帧
+        FramePtr rgbFrame = makeFrame();
+        if (!rgbFrame) {
+            qWarning() << "无法分配RGB视频帧";
+            return;
+        }
+        rgbFrame->format = AV_PIX_FMT_RGB24;
+        rgbFrame->width = frame->width;
+        rgbFrame->height = frame->height;
+        int ret = av_frame_get_buffer(rgbFrame.get(), 0);
+        if (ret < 0) {
+            qWarning() << "无法分配RGB视频帧数据缓冲区";
+            return;
+        }
+        swsCtx = sws_getCachedContext(swsCtx, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                      frame->width, frame->height, AV_PIX_FMT_RGB24,
+                                      SWS_BILINEAR, nullptr, nullptr, nullptr);
+        sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height,
+                  rgbFrame->data, rgbFrame->linesize);
+
+        // 将RGB视频帧转换为QImage
+        currentImage = QImage(rgbFrame->data[0], rgbFrame->width, rgbFrame->height, rgbFrame->linesize[0], QImage::Format_RGB888).copy();
     }
-    sws_scale(swsCtx, frame->data, frame->linesize, 0, videoCodecCtx->height,
-              rgbFrame->data, rgbFrame->linesize);
-
-    // 将RGB视频帧转换为QImage
-    currentImage = QImage(rgbFrame->data[0], rgbFrame->width, rgbFrame->height, rgbFrame->linesize[0], QImage::Format_RGB888).copy();
 
+    update();
 
-    // 释放视频帧
-    av_frame_free(&frame);
-    av_frame_free(&rgbFrame);
+    if(seekClock.isValid()){
+        m_seekLatency=seekClock.elapsed();
+        seekClock.invalidate();
+        emit seekLatencyChanged();
+    }
 
-    update();
+    //首帧时间分别记录命中和未命中缓存的情况，便于对比
+    if(openClock.isValid()){
+        qint64 firstFrameMs=openClock.elapsed();
+        openClock.invalidate();
+        m_openStats.insert("firstFrameMs",firstFrameMs);
+        m_openStats.insert(probeCacheHit?"firstFrameMsCached":"firstFrameMsUncached",firstFrameMs);
+        qDebug()<<"首帧时间"<<firstFrameMs<<"ms，探测缓存"<<(probeCacheHit?"命中":"未命中");
+        emit openStatsChanged();
+    }
 }
 
 //清除，用于开始下一个新文件
 void VideoPlayer::cleanup() {
+    loudnessAnalyzer->cancel();
+    loudnessAnalyzer->wait();
+    loudnessFile.clear();
+
+    //循环缓冲使用同一个文件，关闭前先结束
+    if (loopBuffer || m_loopB >= 0) {
+        releaseLoop();
+        emit loopChanged();
+    }
+
+    //先让音频线程停止使用解码器，再释放
+    audioThread->deleteAudioSink();
+
     if (swsCtx) {
         sws_freeContext(swsCtx);
         swsCtx = nullptr;
@@ -767,19 +1718,58 @@ void VideoPlayer::cleanup() {
     }
 
 
+    bufferTimer->stop();
+    stateTimer->stop();
+    networkStarved=false;
+    networkPercent=100;
+    setBufferingPercent(0);
+    setState(Idle);
+    seekTimer->stop();
+    pendingSeek=-1;
+    seekTarget=-1;
+
+    //先中断网络读取，结束解复用线程，之后才能关闭上下文
+    if (demuxThread) {
+        if (networkCache) {
+            networkCache->abort();
+        }
+        demuxThread->abort();
+        demuxThread->wait();
+        delete demuxThread;
+        demuxThread = nullptr;
+    }
+    pendingSource.clear();
+
     if (formatCtx) {
+        //没有自带索引的文件，播放中读到了新的关键帧时更新探测缓存
+        if (m_probeCacheEnabled && !networkCache && videoStreamIndex >= 0 && audioStreamIndex >= 0
+            && !videoOwnIndex && keyframeLog.added() > 0) {
+            ProbeCache::save(m_fileName, formatCtx, videoStreamIndex, audioStreamIndex, videoOwnIndex, &keyframeLog);
+        }
+        keyframeLog.reset();
         avformat_close_input(&formatCtx);
         formatCtx = nullptr;
     }
+    videoStreamIndex = -1;
+    audioStreamIndex = -1;
+    if (networkCache) {
+        networkCache->close();
+        delete networkCache;
+        networkCache = nullptr;
+    }
 
 
-    while(!videoQueue.isEmpty()){
-        AVFrame *frame;
-        frame=videoQueue.dequeue();
-        av_frame_free(&frame);
-    }
+    videoFilter->flush(-1);
+    previewSerial=-1;
+    lastFrame.reset();
+    clearHistory();
+    clearFrameQueue();
+    presentPending=false;
+    demuxEof=false;
+    audioDemuxMs=-1;
+    videoDemuxMs=-1;
+    videoDrained=false;
 
-    audioThread->deleteAudioSink();
     cleanVideoPacketQueue();
 
     m_position=0;
@@ -788,3 +1778,431 @@ void VideoPlayer::cleanup() {
     emit durationChanged(m_duration);
 
 }
+
+//设置A-B循环（毫秒），在独立线程中预解码区间，就绪前越过B点时退回为seek到A点
+bool VideoPlayer::setLoop(qint64 a, qint64 b)
+{
+    if(!formatCtx||a<0||b<=a){
+        qWarning()<<"无效的循环区间"<<a<<b;
+        return false;
+    }
+    bool wasServing=loopFromBuffer;
+    releaseLoop();
+
+    m_loopA=a;
+    m_loopB=b;
+    loopBuffer=new LoopBuffer(this);
+    connect(loopBuffer,&LoopBuffer::loopReady,this,[this](bool inMemory){
+        m_loopReady=true;
+        qDebug()<<"循环区间已就绪"<<(inMemory?"内存":"流式");
+        emit loopChanged();
+    });
+    connect(loopBuffer,&LoopBuffer::loopFailed,this,[this]{
+        qWarning()<<"循环缓冲失败，越过B点时直接seek到A点";
+        emit loopChanged();
+    });
+    loopBuffer->setJob(m_fileName,videoStreamIndex,audioStreamIndex,a,b,playbackRate,
+                       qint64(m_loopBudgetMB)*1024*1024);
+    loopBuffer->setGain(normalizationGain);
+    loopBuffer->rewind(playSerial);
+    audioThread->setLoopSource(loopBuffer);
+    loopBuffer->start();
+    emit loopChanged();
+
+    //当前位置不在区间内，或主解码路径已经停在B点，从A点（或区间内的当前位置）重新开始
+    if(m_position<a||m_position>=b){
+        setPosi(a);
+    }else if(wasServing){
+        setPosi(m_position);
+    }
+    return true;
+}
+
+//取消循环，正在从循环缓冲播放时在当前位置恢复正常播放
+void VideoPlayer::clearLoop()
+{
+    bool wasServing=loopFromBuffer;
+    releaseLoop();
+    emit loopChanged();
+    if(wasServing&&formatCtx){
+        setPosi(m_position);
+    }
+}
+
+void VideoPlayer::releaseLoop()
+{
+    if(loopBuffer){
+        audioThread->setLoopSource(nullptr);
+        delete loopBuffer;      //析构中停止并等待线程结束
+        loopBuffer=nullptr;
+    }
+    m_loopA=-1;
+    m_loopB=-1;
+    m_loopReady=false;
+    loopVideoPast=false;
+    loopAudioPast=false;
+    loopFromBuffer=false;
+}
+
+//seek后从第一圈重新开始
+void VideoPlayer::resetLoopState(int serial)
+{
+    loopVideoPast=false;
+    loopAudioPast=false;
+    loopFromBuffer=false;
+    if(loopBuffer){
+        loopBuffer->rewind(serial);
+    }
+}
+
+//主解码路径到达B点：循环缓冲就绪时冲刷解码器，之后的帧由循环缓冲提供；否则seek回A点
+void VideoPlayer::wrapLoop()
+{
+    if(!loopBuffer||!loopBuffer->isReady()){
+        setPosi(m_loopA);
+        return;
+    }
+    if(!videoDrained){
+        avcodec_send_packet(videoCodecCtx, nullptr);
+        receiveVideoFrames();
+    }
+    avcodec_flush_buffers(videoCodecCtx);
+    cleanVideoPacketQueue();
+    loopFromBuffer=true;
+    decodeVideo();
+}
+
+//循环输出的时间戳按圈数递增，显示的位置折回[A,B)
+qint64 VideoPlayer::loopPosition(qint64 pts) const
+{
+    if(m_loopB<=m_loopA||pts<m_loopB){
+        return pts;
+    }
+    return m_loopA+(pts-m_loopA)%(m_loopB-m_loopA);
+}
+
+QString VideoPlayer::loopMode() const
+{
+    if(!loopBuffer){
+        return QString();
+    }
+    if(!m_loopReady){
+        return "pending";
+    }
+    return loopBuffer->inMemory()?"memory":"stream";
+}
+
+//循环缓冲的内存预算，下一次setLoop()时生效
+void VideoPlayer::setLoopBudgetMB(int mb)
+{
+    if(m_loopBudgetMB==mb||mb<=0)
+        return;
+    m_loopBudgetMB=mb;
+    emit loopBudgetMBChanged();
+}
+
+//记录最近的数据包引用，超出historySeconds或maxHistoryBytes的从头部丢弃
+void VideoPlayer::rememberPacket(const AVPacket *packet)
+{
+    if(m_historySeconds<=0||(packet->stream_index!=videoStreamIndex&&packet->stream_index!=audioStreamIndex)){
+        return;
+    }
+    int64_t ts=packet->pts!=AV_NOPTS_VALUE?packet->pts:packet->dts;
+    qint64 ms=ts!=AV_NOPTS_VALUE?qint64(ts*av_q2d(formatCtx->streams[packet->stream_index]->time_base)*1000)
+                                 :(packetHistory.empty()?0:packetHistory.back().ms);
+    PacketPtr ref(av_packet_clone(packet));
+    if(!ref){
+        return;
+    }
+    historyBytes+=ref->size;
+    packetHistory.push_back(CapturedPacket{std::move(ref),ms});
+    while(!packetHistory.empty()&&(ms-packetHistory.front().ms>qint64(m_historySeconds)*1000||historyBytes>maxHistoryBytes)){
+        historyBytes-=packetHistory.front().packet->size;
+        packetHistory.pop_front();
+    }
+}
+
+void VideoPlayer::clearHistory()
+{
+    packetHistory.clear();
+    historyBytes=0;
+}
+
+//截图：引用最近上屏的帧，在线程池中编码，完成后发出snapshotFinished
+bool VideoPlayer::snapshot(const QString &outputFile, int quality)
+{
+    if(!lastFrame){
+        qWarning()<<"还没有显示过画面，无法截图";
+        return false;
+    }
+    QUrl url(outputFile);
+    QString path=url.isLocalFile()?url.toLocalFile():outputFile;
+    if(SnapshotTask::codecForFile(path)==AV_CODEC_ID_NONE){
+        qWarning()<<"截图只支持png、jpg和webp"<<path;
+        return false;
+    }
+    FramePtr ref(av_frame_clone(lastFrame.get()));
+    if(!ref){
+        return false;
+    }
+    capturePool->start(new SnapshotTask(std::move(ref),path,quality,
+        [this](bool ok, const QString &file, qint64 elapsedMs){
+            QMetaObject::invokeMethod(this,[this,ok,file,elapsedMs]{
+                emit snapshotFinished(ok,file,elapsedMs);
+            },Qt::QueuedConnection);
+        }));
+    return true;
+}
+
+//导出最近seconds秒：从窗口内第一个视频关键帧开始，按原编码重新封装
+bool VideoPlayer::exportRecent(const QString &outputFile, int seconds)
+{
+    if(!formatCtx||packetHistory.empty()||seconds<=0){
+        qWarning()<<"没有可导出的数据，historySeconds为0时不记录最近的数据包";
+        return false;
+    }
+    QUrl url(outputFile);
+    QString path=url.isLocalFile()?url.toLocalFile():outputFile;
+
+    qint64 cutoff=packetHistory.back().ms-qint64(seconds)*1000;
+    size_t first=packetHistory.size();
+    for(size_t i=0;i<packetHistory.size();++i){
+        const CapturedPacket &item=packetHistory[i];
+        if(item.ms>=cutoff&&item.packet->stream_index==videoStreamIndex&&(item.packet->flags&AV_PKT_FLAG_KEY)){
+            first=i;
+            break;
+        }
+    }
+    if(first==packetHistory.size()){
+        qWarning()<<"最近"<<seconds<<"秒内没有关键帧";
+        return false;
+    }
+
+    //音频从关键帧的时间开始，保证片段开头音画对齐
+    qint64 startMs=packetHistory[first].ms;
+    std::vector<PacketPtr> packets;
+    for(size_t i=first;i<packetHistory.size();++i){
+        const CapturedPacket &item=packetHistory[i];
+        if(item.packet->stream_index==audioStreamIndex&&item.ms<startMs){
+            continue;
+        }
+        PacketPtr ref(av_packet_clone(item.packet.get()));
+        if(ref){
+            packets.push_back(std::move(ref));
+        }
+    }
+
+    QVector<AVCodecParameters*> params(formatCtx->nb_streams,nullptr);
+    QVector<AVRational> timeBases(formatCtx->nb_streams,AVRational{1,1000});
+    for(int index:{videoStreamIndex,audioStreamIndex}){
+        params[index]=avcodec_parameters_alloc();
+        if(params[index]){
+            avcodec_parameters_copy(params[index],formatCtx->streams[index]->codecpar);
+        }
+        timeBases[index]=formatCtx->streams[index]->time_base;
+    }
+
+    capturePool->start(new ClipExportTask(path,params,timeBases,std::move(packets),
+        [this](bool ok, const QString &file){
+            QMetaObject::invokeMethod(this,[this,ok,file]{
+                emit clipExportFinished(ok,file);
+            },Qt::QueuedConnection);
+        }));
+    return true;
+}
+
+//保留的数据包时长，0表示不记录
+void VideoPlayer::setHistorySeconds(int seconds)
+{
+    if(m_historySeconds==seconds||seconds<0)
+        return;
+    m_historySeconds=seconds;
+    if(seconds==0){
+        clearHistory();
+    }
+    emit historySecondsChanged();
+}
+
+//有缓存时直接得到增益；否则在后台分析，完成后写入缓存，增益在下一次重建音频滤镜（seek、变速或重新打开）时生效
+void VideoPlayer::startLoudness(const QString &fileName)
+{
+    loudnessFile=fileName;
+    loudnessKnown=false;
+    m_loudness.clear();
+    if(!networkCache&&LoudnessCache::load(fileName,loudnessResult)){
+        loudnessKnown=true;
+        m_loudness.insert("cached",true);
+    }else if(!networkCache&&m_loudnessNormalization){
+        loudnessAnalyzer->setJob(fileName,audioStreamIndex);
+        loudnessAnalyzer->start(QThread::LowPriority);
+    }
+    updateNormalizationGain();
+}
+
+void VideoPlayer::onLoudnessAnalyzed(const QString &fileName, bool ok, double integrated, double truePeak, double speed, qint64 elapsedMs)
+{
+    m_loudness.insert("analysisSpeed",speed);
+    m_loudness.insert("analysisMs",elapsedMs);
+    if(!ok||fileName!=loudnessFile){
+        emit loudnessChanged();
+        return;
+    }
+    loudnessResult.integrated=integrated;
+    loudnessResult.truePeak=truePeak;
+    loudnessKnown=true;
+    LoudnessCache::save(fileName,loudnessResult);
+    m_loudness.insert("cached",false);
+    updateNormalizationGain();
+}
+
+//按测量结果和目标响度计算增益，交给音频线程
+void VideoPlayer::updateNormalizationGain()
+{
+    normalizationGain=(loudnessKnown&&m_loudnessNormalization)?LoudnessCache::gainFor(loudnessResult,m_loudnessTarget):0;
+    audioThread->setNormalizationGain(normalizationGain);
+    if(loudnessKnown){
+        m_loudness.insert("integrated",loudnessResult.integrated);
+        m_loudness.insert("truePeak",loudnessResult.truePeak);
+    }
+    m_loudness.insert("gainDb",normalizationGain);
+    emit loudnessChanged();
+}
+
+void VideoPlayer::setLoudnessNormalization(bool enabled)
+{
+    if(m_loudnessNormalization==enabled)
+        return;
+    m_loudnessNormalization=enabled;
+    //打开时没有分析过的文件，开启后补做分析
+    if(enabled&&!loudnessKnown&&!loudnessFile.isEmpty()&&!loudnessAnalyzer->isRunning()&&!networkCache){
+        loudnessAnalyzer->setJob(loudnessFile,audioStreamIndex);
+        loudnessAnalyzer->start(QThread::LowPriority);
+    }
+    updateNormalizationGain();
+}
+
+void VideoPlayer::setLoudnessTarget(double lufs)
+{
+    if(qFuzzyCompare(m_loudnessTarget,lufs))
+        return;
+    m_loudnessTarget=lufs;
+    updateNormalizationGain();
+}
+
+void VideoPlayer::setState(PlaybackState state)
+{
+    if(m_state==state)
+        return;
+    bool wasBuffering=m_state==Buffering;
+    m_state=state;
+    emit stateChanged();
+    if(wasBuffering!=(state==Buffering)){
+        emit bufferingChanged();
+    }
+}
+
+void VideoPlayer::setBufferingPercent(int percent)
+{
+    if(m_bufferingPercent==percent)
+        return;
+    m_bufferingPercent=percent;
+    emit bufferingPercentChanged();
+}
+
+//进入预缓冲类状态：停止上屏，音频线程只解码不输出，解复用继续填充队列（网络缓冲不足时除外）
+void VideoPlayer::beginPreroll(PlaybackState state)
+{
+    if(m_state==Playing){
+        setClock(qint64(mediaClockAt(presentNow())));
+    }
+    presentTimer->stop();
+    audioThread->hold();
+    if(networkStarved){
+        timer->stop();
+    }else{
+        timer->start();
+    }
+    setBufferingPercent(0);
+    setState(state);
+    stateTimer->start();
+    updatePlaybackState();
+}
+
+//预缓冲完成：用户要求播放时放开音频输出并开始上屏，否则停在Paused
+void VideoPlayer::finishPreroll()
+{
+    setBufferingPercent(100);
+    if(!m_playing){
+        timer->stop();
+        stateTimer->stop();
+        audioThread->pause();
+        setState(Paused);
+        return;
+    }
+    setState(Playing);
+    audioThread->resume();
+    setClock(customTimebase);
+    schedulePresentation();
+}
+
+//按队列水位推进状态：PCM时长和解码帧数都达到目标后开始播放，播放中PCM欠载转入Buffering，全部播放完转入Ended。
+//文件已读完时不会再有更多数据，对应的队列按已满计算
+void VideoPlayer::updatePlaybackState()
+{
+    if(!formatCtx){
+        return;
+    }
+    bool audioKnown=audioThread->bufferedSerial()==playSerial;
+    qint64 audioMs=audioKnown?audioThread->bufferedMs():0;
+    int frames=int(frameQueue.size());
+    bool audioStalled=videoDemuxMs>=0&&audioDemuxMs>=0&&videoDemuxMs-audioDemuxMs>maxAudioGapMs;
+
+    switch(m_state){
+    case Prerolling:
+    case Seeking:
+    case Buffering:{
+        int audioPercent=demuxEof||audioStalled||m_prerollAudioMs<=0?100:int(qMin<qint64>(100,audioMs*100/m_prerollAudioMs));
+        int videoPercent=videoDrained?100:qMin(100,frames*100/m_prerollFrames);
+        int percent=qMin(qMin(audioPercent,videoPercent),networkPercent);
+        if(percent>=100&&!networkStarved){
+            finishPreroll();
+        }else{
+            setBufferingPercent(qMin(percent,99));
+        }
+        break;
+    }
+    case Playing:
+        if(m_loopB<0&&demuxEof&&videoDrained&&frameQueue.empty()&&videoFilter->pending()==0&&audioKnown&&audioMs==0){
+            m_playing=false;
+            stateTimer->stop();
+            audioThread->pause();
+            setState(Ended);
+        }else if(audioKnown&&!demuxEof&&!audioStalled&&!loopFromBuffer&&audioMs<underrunAudioMs){
+            qDebug()<<"音频欠载，重新缓冲"<<audioMs;
+            beginPreroll(Buffering);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+//预缓冲目标：越大起播和seek越慢，但越不容易断续
+void VideoPlayer::setPrerollAudioMs(int ms)
+{
+    ms=qBound(0,ms,int(AudioThread::maxBufferedMs));
+    if(m_prerollAudioMs==ms)
+        return;
+    m_prerollAudioMs=ms;
+    emit prerollChanged();
+}
+
+//解码队列最多maxDecodedFrames帧，目标不能超过它
+void VideoPlayer::setPrerollFrames(int frames)
+{
+    frames=qBound(1,frames,int(maxDecodedFrames));
+    if(m_prerollFrames==frames)
+        return;
+    m_prerollFrames=frames;
+    emit prerollChanged();
+}
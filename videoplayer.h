@@ -13,7 +13,27 @@
 #include <QWaitCondition>
 #include <QThread>
 #include <QString>
+#include <QVariantMap>
+#include <QElapsedTimer>
+#include <QQuickWindow>
 #include <chrono>
+#include <atomic>
+#include "exportthread.h"
+#include "audiooutput.h"
+#include "networkcache.h"
+#include "commandqueue.h"
+#include "sampleconvert.h"
+#include "probecache.h"
+#include "videofilter.h"
+#include "loopbuffer.h"
+#include "audiograph.h"
+#include "avhandles.h"
+#include "capturetasks.h"
+#include "loudness.h"
+#include "demuxthread.h"
+#include <QThreadPool>
+#include <functional>
+#include <deque>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -26,12 +46,14 @@ extern "C" {
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 }
-struct AudioData{
-    QByteArray buffer;
-    qint64 pts;
-    qint64 duration;
+
+//数据包及其所属的播放代数，seek后旧代数的数据由各级自行丢弃；持有包的所有权，只能移动
+struct PacketItem{
+    PacketPtr packet;
+    int serial=0;
 };
 
+
 class AudioThread : public QThread
 {
     Q_OBJECT
@@ -52,6 +74,8 @@ public:
 
     void pause();
     void resume();
+    void hold();
+    void postCommand(const PlayerCommand &command);
     int init_filters(const char *filters_descr);
 
 
@@ -61,19 +85,40 @@ public:
 
 
     void initAudioThread();
+    void setAudioOutputSpec(const QString &spec);
+    void setLoopSource(LoopBuffer *source);
+    void handleAudioPacket(PacketPtr packet, int serial);
+    void setNormalizationGain(double db);
+    //最近一次公布的PCM水位(ms)及其所属代数，可在任意线程读取
+    qint64 bufferedMs() const{
+        return levelMs.load(std::memory_order_relaxed);
+    }
+    int bufferedSerial() const{
+        return levelSerial.load(std::memory_order_acquire);
+    }
+    static const int maxBufferedMs=2000;    //已解码未输出的PCM达到该时长后暂停解码
     QAudioFormat::SampleFormat ffmpegToQtSampleFormat(AVSampleFormat ffmpegFormat);
 signals:
     void audioFrameReady(qint64 pts);
     void audioProcessed();
-    void sendAudioTimeLine(qint64 timeLine);
+    void sendAudioTimeLine(qint64 timeLine, int serial);
 private slots:
     void processAudio();
 public slots:
-    void handleAudioPacket(AVPacket *packet);
     void receiveAudioParameter(AVFormatContext *format_Ctx,AVCodecContext *audioCodec_Ctx,int *audioStream_Index);
-    void setPlaybackSpeed(double speed);
 
 private:
+    void setPlaybackSpeed(double speed);
+    void updateFilterDescr();
+    void processCommands();
+    bool decodePacket();
+    qint64 queuedMs() const;
+    void publishLevel();
+    void wakeTimer();
+    void flushAudio();
+    void suspendOutput(bool suspend);
+    void publishClock();
+    void runInAudioThread(const std::function<void()> &function);
 
     AVFormatContext *formatCtx = nullptr;
     int *audioStreamIndex = nullptr;
@@ -81,10 +126,9 @@ private:
     AVCodecContext *audioCodecCtx;
     // 音频重采样上下文
     SwrContext *swrCtx;
-    // 音频输出设备
-    QAudioSink *audioSink;
-    // 音频设备输入/输出接口
-    QIODevice *audioIODevice;
+    // 音频输出后端（Qt设备、空输出或WAV文件）
+    AudioOutput *audioOutput=nullptr;
+    QString audioOutputSpec;
     QMutex mutex;
     QWaitCondition condition;
     bool shouldStop = false;
@@ -92,23 +136,40 @@ private:
     qint64 audioClock = 0; /**< 音频时钟 */
     qint64 *audioTimebase=nullptr;
     bool pauseFlag=false;
+    bool holdFlag=false;        //预缓冲：解码但不写入输出
+    bool outputSuspended=false; //暂停和预缓冲时挂起输出，已写入的PCM留在设备缓冲里
+    qint64 writtenUSecs=0;      //本次打开输出以来写入的总时长，与processedUSecs()相减得到设备中未播放的部分
+    double writtenEndMs=-1;     //最后写入的PCM结束处的媒体时间，seek后为-1
+    std::atomic<qint64> levelMs{0};
+    std::atomic<int> levelSerial{-1};
     QQueue<AudioData> audioData;
-    QQueue<AVPacket*> packetQueue;
+    SpscQueue<PacketItem, 1024> packetQueue;
+    SpscQueue<PlayerCommand, 256> commandQueue;
+    int currentSerial=0;        //只在音频线程中读写
+    qint64 seekPosition=-1;     //精确seek目标，之前的PCM不输出
+    QObject *worker=nullptr;    //属于音频线程，用于把调用转到音频线程执行
+
+    //A-B循环，只在音频线程中读写
+    LoopBuffer *loopSource=nullptr;
+    qint64 loopEnd=-1;
+    bool loopPastEnd=false;     //主解码路径已越过B点
+    bool loopPlaying=false;     //PCM由循环缓冲提供
 
     AVFilterContext *buffersink_ctx=nullptr;
     AVFilterContext *buffersrc_ctx=nullptr;
     AVFilterGraph *filter_graph=nullptr;
     qint64 originalPts=0;
+    int64_t filterStartPts=AV_NOPTS_VALUE;  //当前滤镜图第一帧输出的pts（sink时间基），atempo之后的pts从这里按输出样本数递增
 
     double playbackSpeed=2.0;
+    double gainDb=0;            //响度归一化的固定增益
     char filters_descr[64]={0};
     int data_size=0;
 
-    QMediaDevices *outputDevices=nullptr;
-    QAudioDevice outputDevice;
     QAudioFormat format;
+    bool openAudioOutput();
 
-    QTimer *timer;
+    QTimer *timer=nullptr;
     bool timerFlag=false;
 
 };
@@ -122,8 +183,46 @@ class VideoPlayer : public QQuickPaintedItem
     Q_PROPERTY(int videoHeight READ videoHeight NOTIFY videoHeightChanged)
     Q_PROPERTY(qint64 duration READ duration NOTIFY durationChanged)
     Q_PROPERTY(qint64 position READ position WRITE setPosition NOTIFY positionChanged)
+    Q_PROPERTY(QString source READ source NOTIFY sourceChanged)
+    Q_PROPERTY(QString audioSink READ audioSink WRITE setAudioSink NOTIFY audioSinkChanged)
+    Q_PROPERTY(bool buffering READ buffering NOTIFY bufferingChanged)
+    Q_PROPERTY(PlaybackState state READ state NOTIFY stateChanged)
+    Q_PROPERTY(int bufferingPercent READ bufferingPercent NOTIFY bufferingPercentChanged)
+    Q_PROPERTY(int prerollAudioMs READ prerollAudioMs WRITE setPrerollAudioMs NOTIFY prerollChanged)
+    Q_PROPERTY(int prerollFrames READ prerollFrames WRITE setPrerollFrames NOTIFY prerollChanged)
+    Q_PROPERTY(int lowWatermark READ lowWatermark WRITE setLowWatermark NOTIFY watermarkChanged)
+    Q_PROPERTY(int highWatermark READ highWatermark WRITE setHighWatermark NOTIFY watermarkChanged)
+    Q_PROPERTY(QVariantMap networkStats READ networkStats NOTIFY networkStatsChanged)
+    Q_PROPERTY(qint64 seekLatency READ seekLatency NOTIFY seekLatencyChanged)
+    Q_PROPERTY(qint64 previewLatency READ previewLatency NOTIFY seekLatencyChanged)
+    Q_PROPERTY(QVariantMap frameStats READ frameStats NOTIFY frameStatsChanged)
+    Q_PROPERTY(bool probeCacheEnabled READ probeCacheEnabled WRITE setProbeCacheEnabled NOTIFY probeCacheEnabledChanged)
+    Q_PROPERTY(QVariantMap openStats READ openStats NOTIFY openStatsChanged)
+    Q_PROPERTY(QString videoFilters READ videoFilters WRITE setVideoFilters NOTIFY videoFiltersChanged)
+    Q_PROPERTY(qint64 loopA READ loopA NOTIFY loopChanged)
+    Q_PROPERTY(qint64 loopB READ loopB NOTIFY loopChanged)
+    Q_PROPERTY(bool loopReady READ loopReady NOTIFY loopChanged)
+    Q_PROPERTY(QString loopMode READ loopMode NOTIFY loopChanged)
+    Q_PROPERTY(int loopBudgetMB READ loopBudgetMB WRITE setLoopBudgetMB NOTIFY loopBudgetMBChanged)
+    Q_PROPERTY(int historySeconds READ historySeconds WRITE setHistorySeconds NOTIFY historySecondsChanged)
+    Q_PROPERTY(bool loudnessNormalization READ loudnessNormalization WRITE setLoudnessNormalization NOTIFY loudnessChanged)
+    Q_PROPERTY(double loudnessTarget READ loudnessTarget WRITE setLoudnessTarget NOTIFY loudnessChanged)
+    Q_PROPERTY(QVariantMap loudness READ loudness NOTIFY loudnessChanged)
 
 public:
+    //播放状态：打开后先预缓冲，PCM和解码帧都达到目标才开始播放；播放中音频欠载转入Buffering，seek后经Seeking重新预缓冲
+    enum PlaybackState{
+        Idle,
+        Opening,
+        Prerolling,
+        Playing,
+        Paused,
+        Buffering,
+        Seeking,
+        Ended
+    };
+    Q_ENUM(PlaybackState)
+
     VideoPlayer(QQuickItem *parent = nullptr);
     ~VideoPlayer();
     Q_INVOKABLE bool loadFile(const QString &fileName);
@@ -131,7 +230,15 @@ public:
     Q_INVOKABLE void pause();
     Q_INVOKABLE void stop();
     Q_INVOKABLE void setPosi(qint64 position);
+    Q_INVOKABLE void seekPreview(qint64 position);
+    Q_INVOKABLE void seekCommit(qint64 position);
     Q_INVOKABLE void audioSpeed(qreal speed);
+    Q_INVOKABLE bool exportFile(const QString &outputFile, qreal speed);
+    Q_INVOKABLE void cancelExport();
+    Q_INVOKABLE bool setLoop(qint64 a, qint64 b);
+    Q_INVOKABLE void clearLoop();
+    Q_INVOKABLE bool snapshot(const QString &outputFile, int quality = 90);
+    Q_INVOKABLE bool exportRecent(const QString &outputFile, int seconds);
 
     int videoWidth() const {
         return m_videoWidth;
@@ -145,6 +252,90 @@ public:
     qint64 position() const{
         return m_position;
     }
+    QString source() const{
+        return m_fileName;
+    }
+    QString audioSink() const{
+        return m_audioSink;
+    }
+    void setAudioSink(const QString &spec);
+    bool buffering() const{
+        return m_state==Buffering;
+    }
+    PlaybackState state() const{
+        return m_state;
+    }
+    int bufferingPercent() const{
+        return m_bufferingPercent;
+    }
+    int prerollAudioMs() const{
+        return m_prerollAudioMs;
+    }
+    void setPrerollAudioMs(int ms);
+    int prerollFrames() const{
+        return m_prerollFrames;
+    }
+    void setPrerollFrames(int frames);
+    int lowWatermark() const{
+        return m_lowWatermark;
+    }
+    void setLowWatermark(int ms);
+    int highWatermark() const{
+        return m_highWatermark;
+    }
+    void setHighWatermark(int ms);
+    QVariantMap networkStats() const{
+        return m_networkStats;
+    }
+    qint64 seekLatency() const{
+        return m_seekLatency;
+    }
+    qint64 previewLatency() const{
+        return m_previewLatency;
+    }
+    QVariantMap frameStats() const{
+        return m_frameStats;
+    }
+    bool probeCacheEnabled() const{
+        return m_probeCacheEnabled;
+    }
+    void setProbeCacheEnabled(bool enabled);
+    QVariantMap openStats() const{
+        return m_openStats;
+    }
+    QString videoFilters() const{
+        return m_videoFilters;
+    }
+    void setVideoFilters(const QString &filters);
+    qint64 loopA() const{
+        return m_loopA;
+    }
+    qint64 loopB() const{
+        return m_loopB;
+    }
+    bool loopReady() const{
+        return m_loopReady;
+    }
+    QString loopMode() const;
+    int loopBudgetMB() const{
+        return m_loopBudgetMB;
+    }
+    void setLoopBudgetMB(int mb);
+    int historySeconds() const{
+        return m_historySeconds;
+    }
+    void setHistorySeconds(int seconds);
+    bool loudnessNormalization() const{
+        return m_loudnessNormalization;
+    }
+    void setLoudnessNormalization(bool enabled);
+    double loudnessTarget() const{
+        return m_loudnessTarget;
+    }
+    void setLoudnessTarget(double lufs);
+    QVariantMap loudness() const{
+        return m_loudness;
+    }
     void setPosition(int p);
 
     void cleanVideoPacketQueue();
@@ -157,20 +348,77 @@ signals:
     void videoHeightChanged();
     void durationChanged(qint64 duration);
     void positionChanged(qint64 position);
-    void deliverPacketToAudio(AVPacket *deliverPacket);
+    void sourceChanged();
+    void audioSinkChanged();
+    void bufferingChanged();
+    void stateChanged();
+    void bufferingPercentChanged();
+    void prerollChanged();
+    void watermarkChanged();
+    void networkStatsChanged();
+    void seekLatencyChanged();
+    void frameStatsChanged();
+    void probeCacheEnabledChanged();
+    void openStatsChanged();
+    void videoFiltersChanged();
+    void loopChanged();
+    void loopBudgetMBChanged();
+    void historySecondsChanged();
+    void loudnessChanged();
+    void snapshotFinished(bool ok, const QString &outputFile, qint64 elapsedMs);
+    void clipExportFinished(bool ok, const QString &outputFile);
     void sendAudioParameter(AVFormatContext *formatCtx,AVCodecContext *audioCodecCtx,int *audioStreamIndex);
-    void sendSpeed(double speed);
+    void exportProgress(double progress, double realtimeFactor);
+    void exportFinished(bool ok, const QString &outputFile);
 
 protected:
     void paint(QPainter *painter) override;
 public slots:
-    void receiveAudioTimeLine(qint64 timeLine);
+    void receiveAudioTimeLine(qint64 timeLine, int serial);
 
 private slots:
     void onTimeout();
+    void checkBuffer();
+    void updatePlaybackState();
+    void doPreviewSeek();
+    void onFrameSwapped();
+    void schedulePresentation();
+    void handleWindowChanged(QQuickWindow *window);
+    void onFilteredFrames();
+    void onNetworkOpened(int token, bool ok);
+    void onLoudnessAnalyzed(const QString &fileName, bool ok, double integrated, double truePeak, double speed, qint64 elapsedMs);
 private:
+    bool openFile(const QString &fileName);
+    bool openNetwork(const QString &fileName);
+    void findStreams();
+    bool setupStreams(const QString &fileName);
     void cleanup();
+    void presentFrame(AVFrame *frame);
+    void setState(PlaybackState state);
+    void setBufferingPercent(int percent);
+    void beginPreroll(PlaybackState state);
+    void finishPreroll();
     void decodeVideo();
+    bool demuxFull() const;
+    void receiveVideoFrames();
+    void submitFrame(FramePtr frame);
+    void clearFrameQueue();
+    bool presenting() const;
+    double presentNow() const;
+    void setClock(qint64 timeLine);
+    double mediaClockAt(double wallMs) const;
+    double wallForMedia(double mediaMs) const;
+    double nextVsyncAfter(double wallMs) const;
+    void resetFrameStats();
+    void updateFrameStats(bool force);
+    void releaseLoop();
+    void wrapLoop();
+    void resetLoopState(int serial);
+    qint64 loopPosition(qint64 pts) const;
+    void rememberPacket(const AVPacket *packet);
+    void clearHistory();
+    void startLoudness(const QString &fileName);
+    void updateNormalizationGain();
 
     AVFormatContext *formatCtx = nullptr;
     AVCodecContext *videoCodecCtx = nullptr;
@@ -185,13 +433,116 @@ private:
     int videoStreamIndex = -1;
     int audioStreamIndex = -1;
     AudioThread *audioThread = nullptr;
+    ExportThread *exportThread = nullptr;
+    QString m_fileName;
+    QString m_audioSink;
+    NetworkCache *networkCache = nullptr;
+    DemuxThread *demuxThread = nullptr;      //只用于网络输入
+    int openToken = 0;
+    QString pendingSource;                   //后台打开中的网络地址
+    QTimer *bufferTimer = nullptr;
+    bool networkStarved=false;   //网络缓冲低于低水位，等待恢复到高水位
+    int networkPercent=100;
+    int m_lowWatermark=2000;     //网络缓冲低于该时长(ms)时暂停等待
+    int m_highWatermark=6000;    //缓冲恢复到该时长(ms)后继续播放
+    QVariantMap m_networkStats;
+
+    QTimer *seekTimer = nullptr;     //合并拖动过程中的seek请求
+    qint64 pendingSeek=-1;           //只保留最新的预览目标
+    qint64 seekTarget=-1;            //精确seek的目标，之前的帧不显示
+    QElapsedTimer seekClock;         //从发出seek到显示第一帧
+    qint64 m_seekLatency=0;
+    qint64 m_previewLatency=0;
+    static const int maxPreviewPackets=500;
     AVPacket *audioPacket=nullptr;
     qint64 audioClock = 0; /**< 音频时钟 */
     qint64 videoClock = 0; /**< 视频时钟 */
     QMutex mutex;
     double audioPts=0;
-    QQueue<AVFrame*> videoQueue;
-    QQueue<AVPacket*> videoPacketQueue;
+    std::deque<PacketItem> videoPacketQueue;
+    int playSerial=0;    //播放代数，每次seek或打开文件加一
+    bool m_playing=false;        //用户要求播放，预缓冲完成后据此决定进入Playing还是Paused
+    bool demuxEof=false;       //已读到文件尾
+    bool videoDrained=false;   //解码器中剩余的帧已全部取出
+
+    //播放状态机：stateTimer在预缓冲、缓冲、seek和播放中运行，按队列水位切换状态
+    PlaybackState m_state=Idle;
+    QTimer *stateTimer=nullptr;
+    int m_bufferingPercent=0;
+    int m_prerollAudioMs=300;        //开始播放前至少解码好的PCM时长，不超过AudioThread::maxBufferedMs
+    int m_prerollFrames=4;           //开始播放前至少解码好的视频帧数，不超过maxDecodedFrames
+    static const int underrunAudioMs=40;     //播放中PCM低于该时长视为欠载
+    static const int maxAudioGapMs=2000;     //视频已读到音频之后这么远，认为音频流已结束，不再等待PCM
+    static const int maxQueuedVideoPackets=120;  //待解码的视频包达到该数量后暂停解复用
+    qint64 audioDemuxMs=-1;                  //最近读到的音频包时间(ms)
+    qint64 videoDemuxMs=-1;                  //最近读到的视频包时间(ms)
+
+    //显示由渲染循环驱动：每次frameSwapped后按下一个vsync的预测时间选帧
+    std::deque<VideoFrame> frameQueue;
+    static const int maxDecodedFrames=8;
+    static const int renderMargin=3;         //提交到上屏至少需要的时间(ms)
+    static const int maxExtrapolation=100;   //音频时钟停止更新后最多外推的时间(ms)
+    QTimer *presentTimer=nullptr;            //下一帧到期前唤醒，没有待显示的帧时不运行
+    QElapsedTimer presentClock;
+    std::atomic<qint64> lastSwapNs{0};       //渲染线程记录的最近一次交换时间
+    QMetaObject::Connection swapConnection;
+    double vsyncLast=0;
+    double vsyncInterval=1000.0/60;
+    double clockWall=0;                      //customTimebase更新时的presentClock时间(ms)
+    double playbackRate=1.0;
+    bool presentPending=false;               //已调用update()，等待frameSwapped
+    double presentDue=0;                     //待上屏帧按媒体时钟应当显示的时间
+    double presentTarget=0;                  //待上屏帧预测的vsync时间
+
+    qint64 framesPresented=0;
+    qint64 framesRepeated=0;     //下一帧来不及上屏，上一帧多显示的vsync数
+    qint64 framesSkipped=0;      //解码了但没有上屏的帧
+    double jitterMean=0;
+    double jitterVar=0;
+    double lastStatsEmit=0;
+    QVariantMap m_frameStats;
+
+    //探测缓存与首帧时间统计
+    bool m_probeCacheEnabled=true;
+    bool probeCacheHit=false;
+    bool videoOwnIndex=false;        //解复用器自带索引，不需要记录播放中的关键帧
+    KeyframeLog keyframeLog;         //播放中读到的关键帧，关闭时有新增才重新保存
+    QElapsedTimer openClock;         //从loadFile()开始到第一帧上屏
+    QVariantMap m_openStats;
+
+    //视频滤镜在独立线程中执行，输出RGB24帧
+    VideoFilterThread *videoFilter=nullptr;
+    QString m_videoFilters;
+    int previewSerial=-1;            //关键帧预览的代数，滤镜输出后立即显示
+    QElapsedTimer previewClock;
+
+    //A-B循环：第一次越过B点时主解码路径冲刷完后切换到循环缓冲
+    LoopBuffer *loopBuffer=nullptr;
+    qint64 m_loopA=-1;
+    qint64 m_loopB=-1;
+    bool m_loopReady=false;
+    int m_loopBudgetMB=256;
+    bool loopVideoPast=false;        //解码出的视频帧已越过B点
+    bool loopAudioPast=false;        //读到的音频包已越过B点
+    bool loopFromBuffer=false;       //视频帧由循环缓冲提供，不再解复用
+
+    //截图和片段导出在线程池中执行，不阻塞界面线程
+    QThreadPool *capturePool=nullptr;
+    FramePtr lastFrame;                      //最近上屏的帧，截图时只增加引用
+    std::deque<CapturedPacket> packetHistory;   //最近historySeconds秒的数据包引用
+    int m_historySeconds=0;                     //默认不记录，需要导出最近片段时再打开
+    qint64 historyBytes=0;
+    static const qint64 maxHistoryBytes=64LL*1024*1024;    //高码率文件按字节上限从头部丢弃
+
+    //响度归一化：后台分析整个文件，结果缓存，打开时在音频滤镜中加固定增益
+    LoudnessAnalyzer *loudnessAnalyzer=nullptr;
+    QString loudnessFile;                //正在分析或已有结果的文件
+    LoudnessResult loudnessResult;
+    bool loudnessKnown=false;
+    bool m_loudnessNormalization=true;
+    double m_loudnessTarget=-23.0;       //EBU R128
+    double normalizationGain=0;
+    QVariantMap m_loudness;
 
 
     int m_videoWidth=0;
@@ -0,0 +1,409 @@
+#include "waveform.h"
+#include "peakkernels.h"
+#include "networkcache.h"
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QUrl>
+#include <QVector>
+#include <cmath>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char waveformMagic[4]={'W','P','K','1'};
+static const quint32 waveformVersion=1;
+
+//qml传入的可能是file:///形式的url，转换为本地路径
+static QString localPath(const QString &fileName)
+{
+    QUrl url(fileName);
+    return url.isLocalFile()?url.toLocalFile():fileName;
+}
+
+WaveformAnalyzer::WaveformAnalyzer(QObject *parent)
+    : QThread(parent){
+
+}
+
+WaveformAnalyzer::~WaveformAnalyzer() {
+    cancel();
+    wait();
+}
+
+void WaveformAnalyzer::setSource(const QString &fileName)
+{
+    sourceFile=fileName;
+}
+
+void WaveformAnalyzer::cancel()
+{
+    cancelFlag=true;
+}
+
+//缓存文件放在系统缓存目录下，以文件路径的哈希命名
+QString WaveformAnalyzer::sidecarPath(const QString &fileName)
+{
+    QString path=QFileInfo(localPath(fileName)).absoluteFilePath();
+    QByteArray key=QCryptographicHash::hash(path.toUtf8(),QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+           +"/waveform/"+QString::fromLatin1(key)+".peaks";
+}
+
+//文件大小或修改时间变化后缓存失效
+bool WaveformAnalyzer::sidecarValid(const QString &fileName, const WaveformHeader &header)
+{
+    QFileInfo info(localPath(fileName));
+    return memcmp(header.magic,waveformMagic,sizeof(waveformMagic))==0
+           && header.version==waveformVersion
+           && header.fileSize==info.size()
+           && header.mtime==info.lastModified().toMSecsSinceEpoch();
+}
+
+//解码整条音轨，按区间统计min/max/rms
+bool WaveformAnalyzer::analyze(QVector<WaveformPeak> &peaks, quint32 &sampleRate, qint64 &durationMs)
+{
+    AVFormatContext *fmtCtx=nullptr;
+    AVCodecContext *codecCtx=nullptr;
+    SwrContext *swr=nullptr;
+    AVPacket *packet=nullptr;
+    AVFrame *frame=nullptr;
+    QVector<PeakKernels::PeakAccum> accums;
+    QVector<float> samples;
+    int streamIndex=-1;
+    int channels=0;
+    int64_t totalFrames=0;
+    int64_t framePos=0;
+    int64_t samplesPerBucket=1;
+    AVCodec *codec=nullptr;
+    AVStream *st=nullptr;
+    bool ok=false;
+    int ret=0;
+    QElapsedTimer reportClock;
+    qint64 lastReport=0;
+    int lastPercent=-1;
+
+    if (avformat_open_input(&fmtCtx, sourceFile.toStdString().c_str(), nullptr, nullptr) != 0) {
+        qWarning() << "波形：无法打开文件";
+        return false;
+    }
+    if (avformat_find_stream_info(fmtCtx, nullptr) < 0) {
+        qWarning() << "波形：无法获取流信息";
+        goto end;
+    }
+    streamIndex = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
+    if (streamIndex < 0 || !codec) {
+        qWarning() << "波形：未找到音频流";
+        goto end;
+    }
+    st = fmtCtx->streams[streamIndex];
+
+    //丢弃其他流，减少解复用开销
+    for (unsigned int i = 0; i < fmtCtx->nb_streams; ++i) {
+        if ((int)i != streamIndex)
+            fmtCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    codecCtx = avcodec_alloc_context3(codec);
+    if (!codecCtx || avcodec_parameters_to_context(codecCtx, st->codecpar) < 0)
+        goto end;
+    codecCtx->pkt_timebase = st->time_base;
+    codecCtx->thread_count = 1;   //只用一个线程，不和播放抢CPU
+    if (avcodec_open2(codecCtx, codec, nullptr) < 0) {
+        qWarning() << "波形：无法打开音频解码器";
+        goto end;
+    }
+    if (!codecCtx->channel_layout)
+        codecCtx->channel_layout = av_get_default_channel_layout(codecCtx->channels);
+    channels = codecCtx->channels;
+
+    //统一转换为交错float，保持声道数，所有声道一起统计
+    swr = swr_alloc_set_opts(nullptr,
+                             codecCtx->channel_layout, AV_SAMPLE_FMT_FLT, codecCtx->sample_rate,
+                             codecCtx->channel_layout, codecCtx->sample_fmt, codecCtx->sample_rate,
+                             0, nullptr);
+    if (!swr || swr_init(swr) < 0) {
+        qWarning() << "波形：无法初始化重采样";
+        goto end;
+    }
+
+    if (st->duration > 0)
+        totalFrames = av_rescale_q(st->duration, st->time_base, AVRational{1, codecCtx->sample_rate});
+    else if (fmtCtx->duration > 0)
+        totalFrames = av_rescale(fmtCtx->duration, codecCtx->sample_rate, AV_TIME_BASE);
+    samplesPerBucket = totalFrames > 0 ? (totalFrames + targetBuckets - 1) / targetBuckets
+                                       : codecCtx->sample_rate / 10;
+    samplesPerBucket = qMax<int64_t>(samplesPerBucket, 1);
+    accums.reserve(targetBuckets + 1);
+
+    packet = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!packet || !frame)
+        goto end;
+
+    reportClock.start();
+    while (!cancelFlag && av_read_frame(fmtCtx, packet) >= 0) {
+        if (packet->stream_index != streamIndex) {
+            av_packet_unref(packet);
+            continue;
+        }
+        ret = avcodec_send_packet(codecCtx, packet);
+        av_packet_unref(packet);
+        if (ret < 0)
+            continue;
+
+        while (avcodec_receive_frame(codecCtx, frame) >= 0) {
+            int outCount = swr_get_out_samples(swr, frame->nb_samples);
+            samples.resize(outCount * channels);
+            uint8_t *out[1] = {reinterpret_cast<uint8_t*>(samples.data())};
+            int converted = swr_convert(swr, out, outCount,
+                                        (const uint8_t **)frame->extended_data, frame->nb_samples);
+            av_frame_unref(frame);
+            if (converted <= 0)
+                continue;
+
+            //按区间边界切分后送入向量化内核
+            const float *ptr = samples.constData();
+            int64_t remaining = converted;
+            while (remaining > 0) {
+                int64_t index = framePos / samplesPerBucket;
+                int64_t take = qMin(remaining, samplesPerBucket - framePos % samplesPerBucket);
+                if (accums.size() <= index)
+                    accums.resize(index + 1);
+                PeakKernels::accumulate(ptr, size_t(take * channels), accums[index]);
+                ptr += take * channels;
+                framePos += take;
+                remaining -= take;
+            }
+        }
+
+        //和导出一样限制上报频率：整百分比变化或距上次超过100ms才发信号
+        if (totalFrames > 0) {
+            double progress = qMin(1.0, double(framePos) / totalFrames);
+            int percent = int(progress * 100);
+            qint64 elapsed = reportClock.elapsed();
+            if (percent != lastPercent || elapsed - lastReport >= 100) {
+                lastPercent = percent;
+                lastReport = elapsed;
+                emit progressChanged(progress);
+            }
+        }
+    }
+
+    if (cancelFlag || accums.isEmpty())
+        goto end;
+
+    peaks.resize(accums.size());
+    for (int i = 0; i < accums.size(); ++i) {
+        const PeakKernels::PeakAccum &acc = accums[i];
+        double rms = acc.count ? std::sqrt(acc.sumSq / acc.count) : 0.0;
+        peaks[i].min = qint16(qBound(-1.0f, acc.min, 1.0f) * 32767);
+        peaks[i].max = qint16(qBound(-1.0f, acc.max, 1.0f) * 32767);
+        peaks[i].rms = qint16(qMin(1.0, rms) * 32767);
+    }
+    sampleRate = codecCtx->sample_rate;
+    durationMs = framePos * 1000 / codecCtx->sample_rate;
+    ok = true;
+
+end:
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    swr_free(&swr);
+    avcodec_free_context(&codecCtx);
+    avformat_close_input(&fmtCtx);
+    return ok;
+}
+
+//先写临时文件再替换，避免读到写了一半的缓存
+bool WaveformAnalyzer::writeSidecar(const QVector<WaveformPeak> &peaks, quint32 sampleRate, qint64 durationMs)
+{
+    QString path=sidecarPath(sourceFile);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QFileInfo info(localPath(sourceFile));
+    WaveformHeader header;
+    memcpy(header.magic,waveformMagic,sizeof(waveformMagic));
+    header.version=waveformVersion;
+    header.bucketCount=quint32(peaks.size());
+    header.sampleRate=sampleRate;
+    header.durationMs=durationMs;
+    header.fileSize=info.size();
+    header.mtime=info.lastModified().toMSecsSinceEpoch();
+
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning()<<"波形：无法写入缓存文件"<<path;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header),sizeof(header));
+    file.write(reinterpret_cast<const char*>(peaks.constData()),peaks.size()*sizeof(WaveformPeak));
+    return file.commit();
+}
+
+//分析线程入口
+void WaveformAnalyzer::run()
+{
+    cancelFlag=false;
+#ifdef Q_OS_LINUX
+    //Linux普通调度策略下QThread优先级无效，用nice值降低本线程优先级
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    QVector<WaveformPeak> peaks;
+    quint32 sampleRate=0;
+    qint64 durationMs=0;
+    bool ok=analyze(peaks,sampleRate,durationMs)&&writeSidecar(peaks,sampleRate,durationMs);
+    emit analysisFinished(sourceFile,ok);
+}
+
+WaveformView::WaveformView(QQuickItem *parent)
+    : QQuickPaintedItem(parent),
+    analyzer(new WaveformAnalyzer(this)) {
+    connect(analyzer,&WaveformAnalyzer::analysisFinished,this,&WaveformView::onAnalysisFinished);
+    connect(analyzer,&WaveformAnalyzer::progressChanged,this,&WaveformView::onProgress);
+}
+
+WaveformView::~WaveformView() {
+    analyzer->cancel();
+    analyzer->wait();
+    unmapSidecar();
+}
+
+//切换文件：有有效缓存直接映射，否则启动后台分析
+void WaveformView::setSource(const QString &source)
+{
+    if(m_source==source)
+        return;
+
+    analyzer->cancel();
+    analyzer->wait();
+    unmapSidecar();
+
+    m_source=source;
+    m_progress=0;
+    emit sourceChanged();
+    emit progressChanged();
+    emit readyChanged();
+    update();
+
+    //网络输入不做整文件分析，避免额外下载
+    if(m_source.isEmpty()||NetworkCache::isNetworkUrl(m_source))
+        return;
+
+    if(mapSidecar()){
+        m_progress=1;
+        emit progressChanged();
+        emit readyChanged();
+        update();
+        return;
+    }
+
+    analyzer->setSource(m_source);
+    analyzer->start(QThread::LowestPriority);
+}
+
+void WaveformView::setColor(const QColor &color)
+{
+    if(m_color==color)
+        return;
+    m_color=color;
+    emit colorChanged();
+    update();
+}
+
+void WaveformView::onProgress(double progress)
+{
+    m_progress=progress;
+    emit progressChanged();
+}
+
+void WaveformView::onAnalysisFinished(const QString &fileName, bool ok)
+{
+    if(fileName!=m_source)
+        return;
+    if(ok&&mapSidecar()){
+        m_progress=1;
+        emit progressChanged();
+        emit readyChanged();
+        update();
+    }
+}
+
+//映射缓存文件，峰值数据不再拷贝
+bool WaveformView::mapSidecar()
+{
+    sidecarFile.setFileName(WaveformAnalyzer::sidecarPath(m_source));
+    if(!sidecarFile.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 size=sidecarFile.size();
+    if(size<qint64(sizeof(WaveformHeader))){
+        sidecarFile.close();
+        return false;
+    }
+    mapped=sidecarFile.map(0,size);
+    if(!mapped){
+        sidecarFile.close();
+        return false;
+    }
+
+    const WaveformHeader *header=reinterpret_cast<const WaveformHeader*>(mapped);
+    if(!WaveformAnalyzer::sidecarValid(m_source,*header)
+        ||size<qint64(sizeof(WaveformHeader)+header->bucketCount*sizeof(WaveformPeak))){
+        unmapSidecar();
+        return false;
+    }
+
+    bucketCount=header->bucketCount;
+    peaks=reinterpret_cast<const WaveformPeak*>(mapped+sizeof(WaveformHeader));
+    return true;
+}
+
+void WaveformView::unmapSidecar()
+{
+    if(mapped){
+        sidecarFile.unmap(mapped);
+        mapped=nullptr;
+    }
+    if(sidecarFile.isOpen())
+        sidecarFile.close();
+    peaks=nullptr;
+    bucketCount=0;
+}
+
+//每一列像素合并对应区间：浅色画峰值范围，深色画rms
+void WaveformView::paint(QPainter *painter)
+{
+    if(!peaks||bucketCount==0)
+        return;
+
+    int w=int(width());
+    qreal mid=height()/2;
+    qreal scale=mid/32767.0;
+    QColor rmsColor=m_color;
+    rmsColor.setAlpha(qMin(255,m_color.alpha()*2));
+
+    for(int x=0;x<w;++x){
+        quint32 b0=quint32(qint64(x)*bucketCount/w);
+        quint32 b1=qMax(b0+1,quint32(qint64(x+1)*bucketCount/w));
+        b1=qMin(b1,bucketCount);
+        qint16 mn=0,mx=0,rms=0;
+        for(quint32 b=b0;b<b1;++b){
+            mn=qMin(mn,peaks[b].min);
+            mx=qMax(mx,peaks[b].max);
+            rms=qMax(rms,peaks[b].rms);
+        }
+        painter->setPen(m_color);
+        painter->drawLine(QPointF(x,mid-mx*scale),QPointF(x,mid-mn*scale));
+        painter->setPen(rmsColor);
+        painter->drawLine(QPointF(x,mid-rms*scale),QPointF(x,mid+rms*scale));
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <QObject>
+#include <QQuickPaintedItem>
+#include <QPainter>
+#include <QThread>
+#include <QString>
+#include <QColor>
+#include <QFile>
+#include <QDebug>
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+}
+
+//波形缓存文件（sidecar）格式：文件头 + bucketCount个WaveformPeak
+struct WaveformHeader{
+    char magic[4];
+    quint32 version;
+    quint32 bucketCount;
+    quint32 sampleRate;
+    qint64 durationMs;
+    qint64 fileSize;
+    qint64 mtime;
+};
+
+//每个区间的峰值，归一化到int16以减小文件体积
+struct WaveformPeak{
+    qint16 min;
+    qint16 max;
+    qint16 rms;
+};
+
+//后台波形分析：独立的解复用/解码上下文，低优先级线程运行，不影响播放的processAudio()
+class WaveformAnalyzer : public QThread
+{
+    Q_OBJECT
+public:
+    WaveformAnalyzer(QObject *parent = nullptr);
+    ~WaveformAnalyzer();
+
+    void setSource(const QString &fileName);
+    void cancel();
+
+    void run() override;
+
+    static QString sidecarPath(const QString &fileName);
+    static bool sidecarValid(const QString &fileName, const WaveformHeader &header);
+
+    static const int targetBuckets = 4096;
+
+signals:
+    void progressChanged(double progress);
+    void analysisFinished(const QString &fileName, bool ok);
+
+private:
+    bool analyze(QVector<WaveformPeak> &peaks, quint32 &sampleRate, qint64 &durationMs);
+    bool writeSidecar(const QVector<WaveformPeak> &peaks, quint32 sampleRate, qint64 durationMs);
+
+    QString sourceFile;
+    std::atomic<bool> cancelFlag{false};
+};
+
+//在进度条后面绘制波形概览，从内存映射的sidecar文件中直接读取峰值
+class WaveformView : public QQuickPaintedItem
+{
+    Q_OBJECT
+    QML_ELEMENT
+    Q_PROPERTY(QString source READ source WRITE setSource NOTIFY sourceChanged)
+    Q_PROPERTY(QColor color READ color WRITE setColor NOTIFY colorChanged)
+    Q_PROPERTY(double progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(bool ready READ ready NOTIFY readyChanged)
+
+public:
+    WaveformView(QQuickItem *parent = nullptr);
+    ~WaveformView();
+
+    QString source() const{
+        return m_source;
+    }
+    void setSource(const QString &source);
+    QColor color() const{
+        return m_color;
+    }
+    void setColor(const QColor &color);
+    double progress() const{
+        return m_progress;
+    }
+    bool ready() const{
+        return peaks!=nullptr;
+    }
+
+    void paint(QPainter *painter) override;
+
+signals:
+    void sourceChanged();
+    void colorChanged();
+    void progressChanged();
+    void readyChanged();
+
+private slots:
+    void onAnalysisFinished(const QString &fileName, bool ok);
+    void onProgress(double progress);
+
+private:
+    bool mapSidecar();
+    void unmapSidecar();
+
+    QString m_source;
+    QColor m_color=QColor(255,255,255,90);
+    double m_progress=0;
+
+    WaveformAnalyzer *analyzer=nullptr;
+    QFile sidecarFile;
+    uchar *mapped=nullptr;
+    const WaveformPeak *peaks=nullptr;
+    quint32 bucketCount=0;
+};
+
+#endif // WAVEFORM_H